@@ -0,0 +1,141 @@
+/* Screen-space text labels drawn by one actor, however many there are           */
+
+#ifndef PCL_VISUALIZER_ANNOTATIONS_H_
+#define PCL_VISUALIZER_ANNOTATIONS_H_
+
+#include <string>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+
+#include <vtkActor2D.h>
+#include <vtkCoordinate.h>
+#include <vtkLabeledDataMapper.h>
+#include <vtkPointData.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+#include <vtkRenderer.h>
+#include <vtkSmartPointer.h>
+#include <vtkStringArray.h>
+#include <vtkTextProperty.h>
+#include <vtkVersion.h>
+
+// Labels are the points of a single polydata, in display coordinates, with
+// their text as a string field; a vtkLabeledDataMapper draws them all in one
+// pass. Removing a label moves the last one into its place, so adding and
+// removing are constant time and clearing only resets the arrays.
+class AnnotationLayer
+{
+  public:
+    AnnotationLayer (vtkRenderer* renderer) : renderer_ (renderer), next_id_ (0)
+    {
+      points_ = vtkSmartPointer<vtkPoints>::New ();
+      labels_ = vtkSmartPointer<vtkStringArray>::New ();
+      labels_->SetName ("labels");
+      vtkSmartPointer<vtkPolyData> polydata = vtkSmartPointer<vtkPolyData>::New ();
+      polydata->SetPoints (points_);
+      polydata->GetPointData ()->AddArray (labels_);
+      polydata_ = polydata;
+
+      vtkSmartPointer<vtkCoordinate> display = vtkSmartPointer<vtkCoordinate>::New ();
+      display->SetCoordinateSystemToDisplay ();
+      vtkSmartPointer<vtkLabeledDataMapper> mapper = vtkSmartPointer<vtkLabeledDataMapper>::New ();
+#if VTK_MAJOR_VERSION < 6
+      mapper->SetInput (polydata);
+#else
+      mapper->SetInputData (polydata);
+#endif
+      mapper->SetLabelModeToLabelFieldData ();
+      mapper->SetFieldDataName ("labels");
+      mapper->SetTransformCoordinate (display);
+      // Same look as PCLVisualizer::addText
+      vtkTextProperty* text = mapper->GetLabelTextProperty ();
+      text->SetFontSize (10);
+      text->SetColor (1.0, 1.0, 1.0);
+      text->SetJustificationToLeft ();
+      text->SetVerticalJustificationToBottom ();
+      text->ShadowOff ();
+
+      actor_ = vtkSmartPointer<vtkActor2D>::New ();
+      actor_->SetMapper (mapper);
+      renderer_->AddActor2D (actor_);
+    }
+
+    ~AnnotationLayer ()
+    {
+      renderer_->RemoveActor2D (actor_);
+    }
+
+    // Returns the id that removes the label again
+    unsigned int
+    add (const std::string& text, double x, double y)
+    {
+      unsigned int id = next_id_++;
+      slots_[id] = ids_.size ();
+      ids_.push_back (id);
+      points_->InsertNextPoint (x, y, 0.0);
+      labels_->InsertNextValue (text);
+      modified ();
+      return (id);
+    }
+
+    bool
+    remove (unsigned int id)
+    {
+      boost::unordered_map<unsigned int, size_t>::iterator it = slots_.find (id);
+      if (it == slots_.end ())
+        return (false);
+      size_t slot = it->second, last = ids_.size () - 1;
+      slots_.erase (it);
+      if (slot != last)
+      {
+        double p[3];
+        points_->GetPoint (static_cast<vtkIdType> (last), p);
+        points_->SetPoint (static_cast<vtkIdType> (slot), p);
+        labels_->SetValue (static_cast<vtkIdType> (slot), labels_->GetValue (static_cast<vtkIdType> (last)));
+        ids_[slot] = ids_[last];
+        slots_[ids_[slot]] = slot;
+      }
+      ids_.pop_back ();
+      points_->SetNumberOfPoints (static_cast<vtkIdType> (last));
+      labels_->SetNumberOfValues (static_cast<vtkIdType> (last));
+      modified ();
+      return (true);
+    }
+
+    void
+    clear ()
+    {
+      ids_.clear ();
+      slots_.clear ();
+      points_->Reset ();
+      labels_->Reset ();
+      modified ();
+    }
+
+    size_t
+    size () const
+    {
+      return (ids_.size ());
+    }
+
+  private:
+    void
+    modified ()
+    {
+      points_->Modified ();
+      labels_->Modified ();
+      polydata_->Modified ();
+    }
+
+    vtkSmartPointer<vtkRenderer> renderer_;
+    vtkSmartPointer<vtkPoints> points_;
+    vtkSmartPointer<vtkStringArray> labels_;
+    vtkSmartPointer<vtkPolyData> polydata_;
+    vtkSmartPointer<vtkActor2D> actor_;
+    std::vector<unsigned int> ids_;                       // label id of each slot
+    boost::unordered_map<unsigned int, size_t> slots_;    // slot of each label id
+    unsigned int next_id_;
+};
+
+#endif  // PCL_VISUALIZER_ANNOTATIONS_H_
@@ -0,0 +1,350 @@
+/* --batch: every point file of a directory loaded, filtered, measured and       */
+/* snapshotted by a pool of workers while the next files are read ahead          */
+
+#ifndef PCL_VISUALIZER_BATCH_H_
+#define PCL_VISUALIZER_BATCH_H_
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/common/time.h>
+#include <pcl/console/time.h>
+
+#include "bench.h"
+#include "binary_loader.h"
+#include "bounded_queue.h"
+#include "camera.h"
+#include "filter_pipeline.h"
+#include "splat_renderer.h"
+#include "xyz_loader.h"
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+struct BatchOptions
+{
+  std::string directory;
+  std::string stats_file;     // JSON lines; empty for standard output
+  std::string snapshot_dir;   // empty for no snapshots
+  int workers;                // 0 for one per thread
+  bool use_cache;
+  std::vector<FilterStage> filters;
+  int snapshot_width, snapshot_height;
+  float splat_size;
+};
+
+// What one file came to; error is set instead of the rest if it failed
+struct BatchResult
+{
+  std::string file, type, error, snapshot;
+  size_t points, kept, bytes;
+  double min[3], max[3], centroid[3];
+  double load_ms, filter_ms, snapshot_ms;
+};
+
+// Point files by extension, compressed text included; the viewer's own
+// .pvcache and .pvpages sidecars and anything else are left out
+inline bool
+isBatchInput (const boost::filesystem::path& path)
+{
+  boost::filesystem::path name = path.filename ();
+  std::string extension = name.extension ().string ();
+  std::transform (extension.begin (), extension.end (), extension.begin (), ::tolower);
+  if (extension == ".gz" || extension == ".zst")
+  {
+    name = name.stem ();
+    extension = name.extension ().string ();
+    std::transform (extension.begin (), extension.end (), extension.begin (), ::tolower);
+  }
+  return (extension == ".txt" || extension == ".xyz" || extension == ".pts" || extension == ".asc" ||
+          extension == ".ply" || extension == ".las");
+}
+
+// Asks the OS to start reading filename into the page cache and returns
+// at once; the reads overlap whatever the caller does next. Elsewhere the
+// file is read when it is parsed.
+inline void
+prefetchFile (const std::string& filename)
+{
+#if defined(__linux__)
+  int fd = open (filename.c_str (), O_RDONLY);
+  if (fd < 0)
+    return;
+  posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+  close (fd);
+#else
+  (void) filename;
+#endif
+}
+
+// Sorted, so runs over the same directory report in a stable order
+inline bool
+listBatchInputs (const std::string& directory, std::vector<std::string>& files)
+{
+  boost::system::error_code ec;
+  boost::filesystem::directory_iterator it (directory, ec), end;
+  if (ec)
+  {
+    std::cerr << "Cannot list " << directory << ": " << ec.message () << std::endl;
+    return (false);
+  }
+  files.clear ();
+  for (; it != end; it.increment (ec))
+  {
+    if (ec)
+      break;
+    if (boost::filesystem::is_regular_file (it->status ()) && isBatchInput (it->path ()))
+      files.push_back (it->path ().string ());
+  }
+  std::sort (files.begin (), files.end ());
+  return (true);
+}
+
+// Bounds and centroid of the finite points
+template <typename PointT> void
+measureCloud (const pcl::PointCloud<PointT>& cloud, BatchResult& result)
+{
+  double sum[3] = { 0.0, 0.0, 0.0 };
+  size_t finite = 0;
+  for (int axis = 0; axis < 3; ++axis)
+  {
+    result.min[axis] = std::numeric_limits<double>::max ();
+    result.max[axis] = -std::numeric_limits<double>::max ();
+  }
+  for (size_t i = 0; i < cloud.points.size (); ++i)
+  {
+    const PointT& p = cloud.points[i];
+    if (!pcl_isfinite (p.x) || !pcl_isfinite (p.y) || !pcl_isfinite (p.z))
+      continue;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+      result.min[axis] = std::min (result.min[axis], static_cast<double> (p.data[axis]));
+      result.max[axis] = std::max (result.max[axis], static_cast<double> (p.data[axis]));
+      sum[axis] += p.data[axis];
+    }
+    ++finite;
+  }
+  for (int axis = 0; axis < 3; ++axis)
+  {
+    if (!finite)
+      result.min[axis] = result.max[axis] = 0.0;
+    result.centroid[axis] = (finite ? sum[axis] / finite : 0.0);
+  }
+}
+
+template <typename PointT> void
+processBatchFile (const BatchOptions& options, pcl::PointCloud<PointT>& cloud, BatchResult& result)
+{
+  pcl::console::TicToc tt;
+  tt.tic ();
+  if (!loadPointFile (result.file, cloud, options.use_cache))
+  {
+    result.error = "cannot load";
+    return;
+  }
+  result.load_ms = tt.toc ();
+  result.points = cloud.points.size ();
+
+  if (!options.filters.empty ())
+  {
+    typename pcl::PointCloud<PointT>::Ptr filtered (new pcl::PointCloud<PointT>);
+    filtered->swap (cloud);
+    BenchReport report;
+    tt.tic ();
+    bool ok = runFilterPipeline<PointT> (options.filters, filtered, report);
+    result.filter_ms = tt.toc ();
+    cloud.swap (*filtered);
+    if (!ok)
+    {
+      result.error = "filter failed";
+      return;
+    }
+  }
+  result.kept = cloud.points.size ();
+  measureCloud (cloud, result);
+
+  if (!options.snapshot_dir.empty ())
+  {
+    tt.tic ();
+    Eigen::Vector3f min_pt, max_pt;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+      min_pt[axis] = static_cast<float> (result.min[axis]);
+      max_pt[axis] = static_cast<float> (result.max[axis]);
+    }
+    pcl::visualization::Camera camera = getDefaultCamera (options.snapshot_width, options.snapshot_height);
+    fitCamera (camera, min_pt, max_pt);
+    SplatRenderer splatter (camera, options.splat_size);
+    splatter.render (cloud);
+    result.snapshot = (boost::filesystem::path (options.snapshot_dir) /
+                       (boost::filesystem::path (result.file).filename ().string () + ".png")).string ();
+    if (!splatter.saveColour (result.snapshot))
+      result.error = "cannot write snapshot";
+    result.snapshot_ms = tt.toc ();
+  }
+}
+
+// The loaders, filters and renderer report on stderr, so when out is the
+// standard output it carries these lines and nothing else
+inline void
+writeBatchResult (std::ostream& out, const BatchResult& r)
+{
+  std::ostringstream line;
+  line << "{\"file\":\"" << escapeJSON (r.file) << "\"";
+  if (!r.error.empty ())
+    line << ",\"error\":\"" << escapeJSON (r.error) << "\"";
+  else
+  {
+    line << ",\"type\":\"" << r.type << "\",\"bytes\":" << r.bytes << ",\"points\":" << r.points
+         << ",\"kept\":" << r.kept << ",\"min\":[" << r.min[0] << "," << r.min[1] << "," << r.min[2]
+         << "],\"max\":[" << r.max[0] << "," << r.max[1] << "," << r.max[2] << "],\"centroid\":["
+         << r.centroid[0] << "," << r.centroid[1] << "," << r.centroid[2] << "],\"load_ms\":" << r.load_ms
+         << ",\"filter_ms\":" << r.filter_ms;
+    if (!r.snapshot.empty ())
+      line << ",\"snapshot\":\"" << escapeJSON (r.snapshot) << "\",\"snapshot_ms\":" << r.snapshot_ms;
+  }
+  line << "}\n";
+  out << line.str ();
+  out.flush ();
+}
+
+
+// --------------------------------------
+// -----Worker pool over a directory-----
+// --------------------------------------
+// One thread goes through the files in order, asks the OS to prefetch each
+// and queues it straight away, at most one file per worker ahead of the
+// workers, so the next files' I/O overlaps the current files' parsing and
+// every file is read from disk once. Every worker parses, filters,
+// measures and snapshots whole files on its share of the threads.
+class BatchRunner
+{
+  public:
+    BatchRunner (const BatchOptions& options, const std::vector<std::string>& files) :
+      options_ (options), files_ (files), out_ (&std::cout),
+      workers_ (std::max (1, std::min (options.workers > 0 ? options.workers : getNumberOfThreads (),
+                                       static_cast<int> (files.size ())))),
+      ready_ (workers_), points_ (0), bytes_ (0), failed_ (0)
+    {
+    }
+
+    int
+    run ()
+    {
+      std::ofstream stats;
+      if (!options_.stats_file.empty ())
+      {
+        stats.open (options_.stats_file.c_str (), std::ios::app);
+        if (!stats)
+        {
+          std::cerr << "Cannot open " << options_.stats_file << " for the batch statistics" << std::endl;
+          return (-1);
+        }
+        out_ = &stats;
+      }
+
+      double start = pcl::getTime ();
+      boost::thread reader (&BatchRunner::readAhead, this);
+      boost::thread_group pool;
+      for (int i = 0; i < workers_; ++i)
+        pool.create_thread (boost::bind (&BatchRunner::work, this));
+      pool.join_all ();
+      reader.join ();
+      double seconds = std::max (pcl::getTime () - start, 1e-9);
+
+      std::cerr << "Batch: " << files_.size () << " files (" << failed_ << " failed), " << points_ << " points, "
+                << bytes_ / (1024.0 * 1024.0) << " MB in " << seconds << " s on " << workers_ << " workers: "
+                << files_.size () / seconds << " files/s, " << points_ / seconds << " points/s, "
+                << bytes_ / (1024.0 * 1024.0) / seconds << " MB/s\n";
+      return (failed_ ? 1 : 0);
+    }
+
+  private:
+    void
+    readAhead ()
+    {
+      for (size_t i = 0; i < files_.size (); ++i)
+      {
+        prefetchFile (files_[i]);
+        if (!ready_.push (i))
+          break;
+      }
+      ready_.close ();
+    }
+
+    void
+    work ()
+    {
+#ifdef _OPENMP
+      // Whole files run side by side, so each gets its share of the cores
+      omp_set_num_threads (std::max (1, omp_get_num_procs () / workers_));
+#endif
+      pcl::PointCloud<pcl::PointXYZ> basic;
+      pcl::PointCloud<pcl::PointXYZI> intensity;
+      pcl::PointCloud<pcl::PointXYZRGB> rgb;
+      size_t index;
+      while (ready_.pop (index))
+      {
+        BatchResult result;
+        result.file = files_[index];
+        result.points = result.kept = 0;
+        result.load_ms = result.filter_ms = result.snapshot_ms = 0.0;
+        boost::system::error_code ec;
+        result.bytes = static_cast<size_t> (boost::filesystem::file_size (result.file, ec));
+
+        PointFileFormat format = detectPointFileFormat (result.file);
+        int columns = (format == POINT_FILE_TEXT ? detectColumns (result.file) : 3);
+        if (columns >= 6 || (format != POINT_FILE_TEXT && hasBinaryColour (result.file, format)))
+        {
+          result.type = "xyzrgb";
+          processBatchFile (options_, rgb, result);
+        }
+        else if (columns == 4 || columns == 5)
+        {
+          result.type = "xyzi";
+          processBatchFile (options_, intensity, result);
+        }
+        else if (columns >= 3)
+        {
+          result.type = "xyz";
+          processBatchFile (options_, basic, result);
+        }
+        else
+          result.error = "not a point file";
+
+        boost::mutex::scoped_lock lock (mutex_);
+        writeBatchResult (*out_, result);
+        if (result.error.empty ())
+        {
+          points_ += result.points;
+          bytes_ += result.bytes;
+        }
+        else
+          ++failed_;
+      }
+    }
+
+    const BatchOptions& options_;
+    const std::vector<std::string>& files_;
+    std::ostream* out_;
+    int workers_;
+    BoundedQueue<size_t> ready_;
+    boost::mutex mutex_;
+    size_t points_, bytes_, failed_;
+};
+
+#endif  // PCL_VISUALIZER_BATCH_H_
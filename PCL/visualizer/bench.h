@@ -0,0 +1,240 @@
+/* Stage timings for the headless --bench mode                                   */
+
+#ifndef PCL_VISUALIZER_BENCH_H_
+#define PCL_VISUALIZER_BENCH_H_
+
+#include <cstdio>
+#include <cstdlib>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <sys/resource.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/console/time.h>
+#include <pcl/visualization/pcl_visualizer.h>
+
+#include <vtkActor.h>
+#include <vtkCamera.h>
+#include <vtkCellArray.h>
+#include <vtkFloatArray.h>
+#include <vtkIdTypeArray.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+#include <vtkPolyDataMapper.h>
+#include <vtkRenderer.h>
+#include <vtkRenderWindow.h>
+#include <vtkSmartPointer.h>
+#include <vtkVersion.h>
+
+#include "xyz_loader.h"
+
+// Largest resident set of the process so far, in bytes
+inline size_t
+getPeakRSS ()
+{
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS info;
+  GetProcessMemoryInfo (GetCurrentProcess (), &info, sizeof (info));
+  return (info.PeakWorkingSetSize);
+#else
+  struct rusage usage;
+  getrusage (RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+  return (static_cast<size_t> (usage.ru_maxrss));
+#else
+  return (static_cast<size_t> (usage.ru_maxrss) * 1024);
+#endif
+#endif
+}
+
+// Resident set of the process now, in bytes
+inline size_t
+getCurrentRSS ()
+{
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS info;
+  GetProcessMemoryInfo (GetCurrentProcess (), &info, sizeof (info));
+  return (info.WorkingSetSize);
+#elif defined(__APPLE__)
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info (mach_task_self (), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t> (&info), &count) != KERN_SUCCESS)
+    return (getPeakRSS ());
+  return (static_cast<size_t> (info.resident_size));
+#else
+  // Second field of statm: resident pages
+  long pages = 0, resident = 0;
+  FILE* statm = fopen ("/proc/self/statm", "r");
+  if (!statm)
+    return (getPeakRSS ());
+  if (fscanf (statm, "%ld %ld", &pages, &resident) != 2)
+    resident = 0;
+  fclose (statm);
+  return (static_cast<size_t> (resident) * static_cast<size_t> (sysconf (_SC_PAGESIZE)));
+#endif
+}
+
+
+// Quotes and backslashes escaped for a JSON string
+inline std::string
+escapeJSON (const std::string& s)
+{
+  std::string out;
+  for (size_t i = 0; i < s.size (); ++i)
+  {
+    if (s[i] == '"' || s[i] == '\\')
+      out += '\\';
+    out += s[i];
+  }
+  return (out);
+}
+
+struct BenchStage
+{
+  std::string name;
+  double ms;
+  size_t points, bytes;
+  std::string note;           // why a stage did not run, if it did not
+};
+
+
+class BenchReport
+{
+  public:
+    void
+    addStage (const std::string& name, double ms, size_t points, size_t bytes)
+    {
+      BenchStage stage;
+      stage.name = name;
+      stage.ms = ms;
+      stage.points = points;
+      stage.bytes = bytes;
+      stages_.push_back (stage);
+    }
+
+    void
+    skipStage (const std::string& name, const std::string& note)
+    {
+      BenchStage stage;
+      stage.name = name;
+      stage.ms = 0.0;
+      stage.points = stage.bytes = 0;
+      stage.note = note;
+      stages_.push_back (stage);
+    }
+
+    // One line of JSON, so runs can be appended to a log and diffed
+    void
+    writeJSON (std::ostream& out, const std::string& file, size_t points) const
+    {
+      double total = 0.0;
+      out << "{\"file\":\"" << escapeJSON (file) << "\",\"points\":" << points
+          << ",\"threads\":" << getNumberOfThreads () << ",\"stages\":[";
+      for (size_t i = 0; i < stages_.size (); ++i)
+      {
+        const BenchStage& s = stages_[i];
+        double seconds = s.ms * 0.001;
+        total += s.ms;
+        out << (i ? "," : "") << "{\"name\":\"" << s.name << "\"";
+        if (!s.note.empty ())
+        {
+          out << ",\"skipped\":\"" << escapeJSON (s.note) << "\"}";
+          continue;
+        }
+        out << ",\"ms\":" << s.ms << ",\"points\":" << s.points << ",\"bytes\":" << s.bytes
+            << ",\"points_per_s\":" << (seconds > 0 ? s.points / seconds : 0.0)
+            << ",\"bytes_per_s\":" << (seconds > 0 ? s.bytes / seconds : 0.0) << "}";
+      }
+      out << "],\"total_ms\":" << total << ",\"peak_rss_bytes\":" << getPeakRSS () << "}\n";
+    }
+
+  private:
+    std::vector<BenchStage> stages_;
+};
+
+
+// -------------------------------------------------------------
+// -----Render one frame of a cloud without opening a window-----
+// -------------------------------------------------------------
+// Builds the same vertex polydata PCLVisualizer uploads and times the first
+// Render(), which includes the upload. Returns false where there is no way to
+// render offscreen (no X display on X11 builds of VTK).
+template <typename PointT> bool
+renderOffscreenFrame (const pcl::PointCloud<PointT>& cloud, const pcl::visualization::Camera& camera, double& ms)
+{
+#if defined(__unix__) && !defined(__APPLE__)
+  if (!std::getenv ("DISPLAY"))
+    return (false);
+#endif
+  const vtkIdType n = static_cast<vtkIdType> (cloud.points.size ());
+  vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New ();
+  points->SetDataTypeToFloat ();
+  points->SetNumberOfPoints (n);
+  float* xyz = static_cast<vtkFloatArray*> (points->GetData ())->GetPointer (0);
+  vtkSmartPointer<vtkIdTypeArray> cells = vtkSmartPointer<vtkIdTypeArray>::New ();
+  cells->SetNumberOfValues (2 * n);
+  vtkIdType* ids = cells->GetPointer (0);
+#pragma omp parallel for
+  for (int i = 0; i < static_cast<int> (n); ++i)
+  {
+    xyz[3 * i] = cloud.points[i].x;
+    xyz[3 * i + 1] = cloud.points[i].y;
+    xyz[3 * i + 2] = cloud.points[i].z;
+    ids[2 * i] = 1;
+    ids[2 * i + 1] = i;
+  }
+  vtkSmartPointer<vtkCellArray> vertices = vtkSmartPointer<vtkCellArray>::New ();
+  vertices->SetCells (n, cells);
+  vtkSmartPointer<vtkPolyData> polydata = vtkSmartPointer<vtkPolyData>::New ();
+  polydata->SetPoints (points);
+  polydata->SetVerts (vertices);
+
+  vtkSmartPointer<vtkPolyDataMapper> mapper = vtkSmartPointer<vtkPolyDataMapper>::New ();
+#if VTK_MAJOR_VERSION < 6
+  mapper->SetInput (polydata);
+#else
+  mapper->SetInputData (polydata);
+#endif
+  vtkSmartPointer<vtkActor> actor = vtkSmartPointer<vtkActor>::New ();
+  actor->SetMapper (mapper);
+
+  vtkSmartPointer<vtkRenderer> renderer = vtkSmartPointer<vtkRenderer>::New ();
+  renderer->SetBackground (0, 0, 0);
+  renderer->AddActor (actor);
+  vtkCamera* cam = renderer->GetActiveCamera ();
+  cam->SetPosition (camera.pos[0], camera.pos[1], camera.pos[2]);
+  cam->SetFocalPoint (camera.focal[0], camera.focal[1], camera.focal[2]);
+  cam->SetViewUp (camera.view[0], camera.view[1], camera.view[2]);
+  cam->SetViewAngle (camera.fovy / M_PI * 180.0);
+  cam->SetClippingRange (camera.clip[0], camera.clip[1]);
+
+  vtkSmartPointer<vtkRenderWindow> window = vtkSmartPointer<vtkRenderWindow>::New ();
+  window->SetOffScreenRendering (1);
+  window->SetSize (static_cast<int> (camera.window_size[0]), static_cast<int> (camera.window_size[1]));
+  window->AddRenderer (renderer);
+
+  pcl::console::TicToc tt;
+  tt.tic ();
+  window->Render ();
+  ms = tt.toc ();
+  return (true);
+}
+
+#endif  // PCL_VISUALIZER_BENCH_H_
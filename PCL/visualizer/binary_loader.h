@@ -0,0 +1,526 @@
+/* Memory mapped readers for binary little-endian PLY and LAS 1.2 - 1.4 files    */
+/* Records are converted straight from the mapping into the cloud on all cores   */
+
+#ifndef PCL_VISUALIZER_BINARY_LOADER_H_
+#define PCL_VISUALIZER_BINARY_LOADER_H_
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/console/time.h>
+
+#include "cloud_cache.h"
+#include "xyz_loader.h"
+
+// Both formats are little-endian on disk; records are read with memcpy, which
+// assumes a little-endian host (x86, ARM)
+
+enum PointFileFormat
+{
+  POINT_FILE_TEXT,
+  POINT_FILE_PLY,
+  POINT_FILE_LAS
+};
+
+inline PointFileFormat
+detectPointFileFormat (const std::string& filename)
+{
+  char magic[4] = { 0, 0, 0, 0 };
+  std::ifstream in (filename.c_str (), std::ios::binary);
+  in.read (magic, sizeof (magic));
+  if (in.gcount () == 4 && std::memcmp (magic, "ply", 3) == 0 && (magic[3] == '\n' || magic[3] == '\r'))
+    return (POINT_FILE_PLY);
+  if (in.gcount () == 4 && std::memcmp (magic, "LASF", 4) == 0)
+    return (POINT_FILE_LAS);
+  return (POINT_FILE_TEXT);
+}
+
+
+// Field types of both formats, with their sizes
+enum ScalarType
+{
+  SCALAR_NONE, SCALAR_INT8, SCALAR_UINT8, SCALAR_INT16, SCALAR_UINT16,
+  SCALAR_INT32, SCALAR_UINT32, SCALAR_FLOAT32, SCALAR_FLOAT64
+};
+
+inline size_t
+getScalarSize (ScalarType type)
+{
+  static const size_t sizes[] = { 0, 1, 1, 2, 2, 4, 4, 4, 8 };
+  return (sizes[type]);
+}
+
+inline double
+readScalar (const char* p, ScalarType type)
+{
+  switch (type)
+  {
+    case SCALAR_INT8:    { int8_t v;   std::memcpy (&v, p, 1); return (v); }
+    case SCALAR_UINT8:   { uint8_t v;  std::memcpy (&v, p, 1); return (v); }
+    case SCALAR_INT16:   { int16_t v;  std::memcpy (&v, p, 2); return (v); }
+    case SCALAR_UINT16:  { uint16_t v; std::memcpy (&v, p, 2); return (v); }
+    case SCALAR_INT32:   { int32_t v;  std::memcpy (&v, p, 4); return (v); }
+    case SCALAR_UINT32:  { uint32_t v; std::memcpy (&v, p, 4); return (v); }
+    case SCALAR_FLOAT32: { float v;    std::memcpy (&v, p, 4); return (v); }
+    case SCALAR_FLOAT64: { double v;   std::memcpy (&v, p, 8); return (v); }
+    default:             return (0.0);
+  }
+}
+
+
+// Colour is only stored by point types that have it
+inline void
+setColour (pcl::PointXYZ&, uint8_t, uint8_t, uint8_t)
+{
+}
+
+inline void
+setColour (pcl::PointXYZRGB& point, uint8_t r, uint8_t g, uint8_t b)
+{
+  point.r = r;
+  point.g = g;
+  point.b = b;
+  point.a = 255;
+}
+
+
+// --------------------------------------------
+// -----Where the fields of a record live-----
+// --------------------------------------------
+struct RecordLayout
+{
+  RecordLayout () : data_offset (0), count (0), stride (0), colour_shift (0), has_colour (false)
+  {
+    for (int k = 0; k < 3; ++k)
+    {
+      xyz_offset[k] = rgb_offset[k] = 0;
+      xyz_type[k] = rgb_type[k] = SCALAR_NONE;
+      scale[k] = 1.0;
+      offset[k] = 0.0;
+    }
+  }
+
+  size_t data_offset, count, stride;
+  size_t xyz_offset[3], rgb_offset[3];
+  ScalarType xyz_type[3], rgb_type[3];
+  double scale[3], offset[3];     // position = stored * scale + offset
+  int colour_shift;               // 8 for 16 bit colour, 0 for 8 bit
+  bool has_colour;
+};
+
+
+// ---------------------------------------------
+// -----Read the header of a binary PLY file-----
+// ---------------------------------------------
+inline ScalarType
+getPLYType (const std::string& name)
+{
+  if (name == "char" || name == "int8")
+    return (SCALAR_INT8);
+  if (name == "uchar" || name == "uint8")
+    return (SCALAR_UINT8);
+  if (name == "short" || name == "int16")
+    return (SCALAR_INT16);
+  if (name == "ushort" || name == "uint16")
+    return (SCALAR_UINT16);
+  if (name == "int" || name == "int32")
+    return (SCALAR_INT32);
+  if (name == "uint" || name == "uint32")
+    return (SCALAR_UINT32);
+  if (name == "float" || name == "float32")
+    return (SCALAR_FLOAT32);
+  if (name == "double" || name == "float64")
+    return (SCALAR_FLOAT64);
+  return (SCALAR_NONE);
+}
+
+// Only the vertex element is read. Elements stored before it are skipped,
+// which needs them to have a fixed record size (no list properties).
+inline bool
+readPLYLayout (const char* data, size_t size, RecordLayout& layout, std::string& error)
+{
+  const char* end_header = NULL;
+  for (const char* p = data; p + 10 <= data + std::min<size_t> (size, 1 << 20); ++p)
+    if (std::memcmp (p, "end_header", 10) == 0)
+    {
+      end_header = p;
+      break;
+    }
+  const char* body = end_header ? static_cast<const char*> (std::memchr (end_header, '\n', data + size - end_header)) : NULL;
+  if (!body)
+  {
+    error = "no end_header";
+    return (false);
+  }
+  layout.data_offset = body + 1 - data;
+
+  std::istringstream header (std::string (data, end_header));
+  std::string line, keyword;
+  bool in_vertex = false, vertex_done = false, fixed = true;
+  size_t skip = 0, element_count = 0, element_stride = 0;
+  while (std::getline (header, line))
+  {
+    std::istringstream tokens (line);
+    tokens >> keyword;
+    if (keyword == "format")
+    {
+      std::string format;
+      tokens >> format;
+      if (format != "binary_little_endian")
+      {
+        error = "format " + format + " is not supported, only binary_little_endian";
+        return (false);
+      }
+    }
+    else if (keyword == "element" && !vertex_done)
+    {
+      if (in_vertex)
+        vertex_done = true;
+      else
+      {
+        // Close the element before this one
+        if (!fixed && element_count > 0)
+        {
+          error = "an element with list properties comes before the vertices";
+          return (false);
+        }
+        if (element_stride && element_count > (std::numeric_limits<size_t>::max () - skip) / element_stride)
+        {
+          error = "elements before the vertices are too large";
+          return (false);
+        }
+        skip += element_count * element_stride;
+        std::string name;
+        tokens >> name >> element_count;
+        element_stride = 0;
+        fixed = true;
+        in_vertex = (name == "vertex");
+        if (in_vertex)
+          layout.count = element_count;
+      }
+    }
+    else if (keyword == "property" && !vertex_done)
+    {
+      std::string type_name, name;
+      tokens >> type_name;
+      if (type_name == "list")
+      {
+        fixed = false;
+        if (in_vertex)
+        {
+          error = "list properties on vertices are not supported";
+          return (false);
+        }
+        continue;
+      }
+      ScalarType type = getPLYType (type_name);
+      tokens >> name;
+      if (type == SCALAR_NONE)
+      {
+        error = "unknown property type " + type_name;
+        return (false);
+      }
+      if (in_vertex)
+      {
+        static const char* xyz[3] = { "x", "y", "z" };
+        static const char* rgb[3] = { "red", "green", "blue" };
+        static const char* diffuse[3] = { "diffuse_red", "diffuse_green", "diffuse_blue" };
+        for (int k = 0; k < 3; ++k)
+        {
+          if (name == xyz[k])
+          {
+            layout.xyz_offset[k] = element_stride;
+            layout.xyz_type[k] = type;
+          }
+          if (name == rgb[k] || name == diffuse[k])
+          {
+            layout.rgb_offset[k] = element_stride;
+            layout.rgb_type[k] = type;
+          }
+        }
+      }
+      element_stride += getScalarSize (type);
+    }
+  }
+  if (!in_vertex)
+  {
+    error = "no vertex element";
+    return (false);
+  }
+  layout.data_offset += skip;
+  layout.stride = element_stride;
+  if (layout.xyz_type[0] == SCALAR_NONE || layout.xyz_type[1] == SCALAR_NONE || layout.xyz_type[2] == SCALAR_NONE)
+  {
+    error = "vertices have no x, y and z";
+    return (false);
+  }
+  layout.has_colour = layout.rgb_type[0] != SCALAR_NONE && layout.rgb_type[1] != SCALAR_NONE &&
+                      layout.rgb_type[2] != SCALAR_NONE;
+  layout.colour_shift = (layout.rgb_type[0] == SCALAR_UINT16 ? 8 : 0);
+  return (true);
+}
+
+
+// ----------------------------------------
+// -----Read the header of a LAS file-----
+// ----------------------------------------
+// Public header block of LAS 1.2 to 1.4; point formats 0 to 10 all start
+// with X Y Z as scaled int32, colour is 16 bit RGB where a format has it
+inline bool
+readLASLayout (const char* data, size_t size, RecordLayout& layout, std::string& error)
+{
+  if (size < 227)
+  {
+    error = "header is truncated";
+    return (false);
+  }
+  uint8_t major = static_cast<uint8_t> (data[24]), minor = static_cast<uint8_t> (data[25]);
+  uint8_t format = static_cast<uint8_t> (data[104]);
+  uint16_t header_size, record_length;
+  uint32_t point_offset, legacy_count;
+  std::memcpy (&header_size, data + 94, 2);
+  std::memcpy (&point_offset, data + 96, 4);
+  std::memcpy (&record_length, data + 105, 2);
+  std::memcpy (&legacy_count, data + 107, 4);
+  if (major != 1 || minor < 2 || minor > 4)
+  {
+    std::ostringstream version;
+    version << "version " << int (major) << "." << int (minor) << " is not supported, only 1.2 to 1.4";
+    error = version.str ();
+    return (false);
+  }
+  if (format & 0xc0)
+  {
+    error = "compressed (LAZ) point data is not supported";
+    return (false);
+  }
+  if (format > 10)
+  {
+    error = "unknown point data format";
+    return (false);
+  }
+
+  layout.count = legacy_count;
+  if (minor == 4 && header_size >= 375 && size >= 255)
+  {
+    uint64_t count;
+    std::memcpy (&count, data + 247, 8);
+    if (count > 0)
+      layout.count = static_cast<size_t> (count);
+  }
+  // Smallest record of each point data format
+  static const size_t min_length[11] = { 20, 28, 26, 34, 57, 63, 30, 36, 38, 59, 67 };
+  if (record_length < min_length[format])
+  {
+    error = "records are shorter than their point data format";
+    return (false);
+  }
+  layout.data_offset = point_offset;
+  layout.stride = record_length;
+  for (int k = 0; k < 3; ++k)
+  {
+    std::memcpy (&layout.scale[k], data + 131 + 8 * k, 8);
+    std::memcpy (&layout.offset[k], data + 155 + 8 * k, 8);
+    layout.xyz_offset[k] = 4 * k;
+    layout.xyz_type[k] = SCALAR_INT32;
+  }
+
+  // Offset of R G B in the record, by point data format
+  static const int rgb_at[11] = { -1, -1, 20, 28, -1, 28, -1, 30, 30, -1, 30 };
+  layout.has_colour = rgb_at[format] >= 0;
+  for (int k = 0; layout.has_colour && k < 3; ++k)
+  {
+    layout.rgb_offset[k] = rgb_at[format] + 2 * k;
+    layout.rgb_type[k] = SCALAR_UINT16;
+  }
+  layout.colour_shift = 8;
+  return (true);
+}
+
+
+// ---------------------------------------------------------
+// -----Convert the records of a mapping into a cloud-----
+// ---------------------------------------------------------
+template <typename PointT> void
+convertRecords (const char* records, const RecordLayout& layout, pcl::PointCloud<PointT>& cloud)
+{
+  const int n = static_cast<int> (layout.count);
+  cloud.points.resize (layout.count);
+  cloud.width = static_cast<uint32_t> (layout.count);
+  cloud.height = 1;
+  cloud.is_dense = true;
+
+  // Float PLY coordinates, the common case, are copied without conversion
+  const bool plain = layout.xyz_type[0] == SCALAR_FLOAT32 && layout.xyz_type[1] == SCALAR_FLOAT32 &&
+                     layout.xyz_type[2] == SCALAR_FLOAT32 && layout.scale[0] == 1.0 && layout.scale[1] == 1.0 &&
+                     layout.scale[2] == 1.0 && layout.offset[0] == 0.0 && layout.offset[1] == 0.0 && layout.offset[2] == 0.0;
+  const bool float_colour = layout.rgb_type[0] == SCALAR_FLOAT32 || layout.rgb_type[0] == SCALAR_FLOAT64;
+#pragma omp parallel for
+  for (int i = 0; i < n; ++i)
+  {
+    const char* record = records + static_cast<size_t> (i) * layout.stride;
+    PointT& point = cloud.points[i];
+    if (plain)
+    {
+      std::memcpy (&point.x, record + layout.xyz_offset[0], 4);
+      std::memcpy (&point.y, record + layout.xyz_offset[1], 4);
+      std::memcpy (&point.z, record + layout.xyz_offset[2], 4);
+    }
+    else
+    {
+      point.x = static_cast<float> (readScalar (record + layout.xyz_offset[0], layout.xyz_type[0]) * layout.scale[0] + layout.offset[0]);
+      point.y = static_cast<float> (readScalar (record + layout.xyz_offset[1], layout.xyz_type[1]) * layout.scale[1] + layout.offset[1]);
+      point.z = static_cast<float> (readScalar (record + layout.xyz_offset[2], layout.xyz_type[2]) * layout.scale[2] + layout.offset[2]);
+    }
+    if (layout.has_colour)
+    {
+      uint8_t rgb[3];
+      for (int k = 0; k < 3; ++k)
+      {
+        double value = readScalar (record + layout.rgb_offset[k], layout.rgb_type[k]);
+        rgb[k] = float_colour ? toColourComponent (static_cast<float> (value * 255.0))
+                              : static_cast<uint8_t> (static_cast<unsigned int> (value) >> layout.colour_shift);
+      }
+      setColour (point, rgb[0], rgb[1], rgb[2]);
+    }
+  }
+}
+
+
+// Some LAS writers store 8 bit colour in the 16 bit fields; a sample of the
+// records tells which, so there is no separate pass over the file
+inline void
+guessLASColourDepth (const char* records, RecordLayout& layout)
+{
+  const size_t samples = std::min<size_t> (layout.count, 4096);
+  for (size_t i = 0; i < samples; ++i)
+  {
+    const char* record = records + (layout.count / samples) * i * layout.stride;
+    for (int k = 0; k < 3; ++k)
+      if (readScalar (record + layout.rgb_offset[k], SCALAR_UINT16) > 255.0)
+        return;
+  }
+  layout.colour_shift = 0;
+}
+
+
+inline bool
+readBinaryLayout (const boost::iostreams::mapped_file_source& file, PointFileFormat format,
+                  RecordLayout& layout, std::string& error)
+{
+  bool ok = (format == POINT_FILE_PLY ? readPLYLayout (file.data (), file.size (), layout, error)
+                                      : readLASLayout (file.data (), file.size (), layout, error));
+  // Every field read must lie inside the record
+  for (int k = 0; ok && k < 3; ++k)
+    if (layout.xyz_offset[k] + getScalarSize (layout.xyz_type[k]) > layout.stride ||
+        (layout.has_colour && layout.rgb_offset[k] + getScalarSize (layout.rgb_type[k]) > layout.stride))
+    {
+      error = "records are shorter than their fields";
+      ok = false;
+    }
+  // Divided rather than multiplied, as a 64 bit count could wrap
+  if (ok && (layout.data_offset > file.size () ||
+             layout.count > (file.size () - layout.data_offset) / layout.stride))
+  {
+    error = "file is shorter than its header says";
+    ok = false;
+  }
+  if (ok && layout.count > static_cast<size_t> (INT_MAX))
+  {
+    error = "too many points";
+    ok = false;
+  }
+  if (ok && format == POINT_FILE_LAS && layout.has_colour)
+    guessLASColourDepth (file.data () + layout.data_offset, layout);
+  return (ok);
+}
+
+
+// --------------------------------------------
+// -----Load a binary PLY or LAS file-----
+// --------------------------------------------
+template <typename PointT> bool
+loadBinaryPointFile (const std::string& filename, PointFileFormat format, pcl::PointCloud<PointT>& cloud)
+{
+  pcl::console::TicToc tt;
+  tt.tic ();
+  boost::iostreams::mapped_file_source file;
+  try
+  {
+    file.open (filename);
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << "Could not map " << filename << ": " << e.what () << std::endl;
+    return (false);
+  }
+
+  RecordLayout layout;
+  std::string error;
+  if (!readBinaryLayout (file, format, layout, error))
+  {
+    std::cerr << "Could not read " << filename << ": " << error << std::endl;
+    return (false);
+  }
+  convertRecords (file.data () + layout.data_offset, layout, cloud);
+
+  double ms = tt.toc ();
+  double mb = layout.count * layout.stride / (1024.0 * 1024.0);
+  std::cerr << "Read " << cloud.points.size () << " points (" << mb << " MB) from "
+            << (format == POINT_FILE_PLY ? "PLY" : "LAS") << " in " << ms << " ms: " << mb / (ms * 0.001 + 1e-9)
+            << " MB/s on " << getNumberOfThreads () << " threads\n";
+  return (true);
+}
+
+
+// True if a binary file stores colour for its points
+inline bool
+hasBinaryColour (const std::string& filename, PointFileFormat format)
+{
+  try
+  {
+    boost::iostreams::mapped_file_source file (filename);
+    RecordLayout layout;
+    std::string error;
+    return (readBinaryLayout (file, format, layout, error) && layout.has_colour);
+  }
+  catch (const std::exception&)
+  {
+    return (false);
+  }
+}
+
+
+// ---------------------------------------------------------------
+// -----Load any supported point file; text goes through the cache-----
+// ---------------------------------------------------------------
+// Binary files are read at close to disk speed already, so they get no
+// sidecar. Intensity is not read from binary files.
+template <typename PointT> bool
+loadPointFile (const std::string& filename, pcl::PointCloud<PointT>& cloud, bool use_cache)
+{
+  PointFileFormat format = detectPointFileFormat (filename);
+  if (format == POINT_FILE_TEXT)
+    return (loadXYZFileCached (filename, cloud, use_cache));
+  return (loadBinaryPointFile (filename, format, cloud));
+}
+
+inline bool
+loadPointFile (const std::string& filename, pcl::PointCloud<pcl::PointXYZI>& cloud, bool use_cache)
+{
+  return (loadXYZFileCached (filename, cloud, use_cache));
+}
+
+#endif  // PCL_VISUALIZER_BINARY_LOADER_H_
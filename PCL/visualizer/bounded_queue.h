@@ -0,0 +1,93 @@
+/* Blocking FIFO with a fixed capacity, used to hand work between threads        */
+
+#ifndef PCL_VISUALIZER_BOUNDED_QUEUE_H_
+#define PCL_VISUALIZER_BOUNDED_QUEUE_H_
+
+#include <cstddef>
+#include <deque>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+template <typename T>
+class BoundedQueue
+{
+  public:
+    explicit BoundedQueue (size_t capacity) : capacity_ (capacity), closed_ (false) {}
+
+    // Blocks while the queue is full. Returns false if the queue was closed.
+    bool
+    push (const T& item)
+    {
+      boost::unique_lock<boost::mutex> lock (mutex_);
+      while (items_.size () >= capacity_ && !closed_)
+        not_full_.wait (lock);
+      if (closed_)
+        return (false);
+      items_.push_back (item);
+      not_empty_.notify_one ();
+      return (true);
+    }
+
+    // Blocks until an item is available. Returns false once the queue is
+    // closed and drained.
+    bool
+    pop (T& item)
+    {
+      boost::unique_lock<boost::mutex> lock (mutex_);
+      while (items_.empty () && !closed_)
+        not_empty_.wait (lock);
+      if (items_.empty ())
+        return (false);
+      item = items_.front ();
+      items_.pop_front ();
+      not_full_.notify_one ();
+      return (true);
+    }
+
+    bool
+    tryPop (T& item)
+    {
+      boost::unique_lock<boost::mutex> lock (mutex_);
+      if (items_.empty ())
+        return (false);
+      item = items_.front ();
+      items_.pop_front ();
+      not_full_.notify_one ();
+      return (true);
+    }
+
+    // No more pushes; consumers still get the queued items
+    void
+    close ()
+    {
+      boost::unique_lock<boost::mutex> lock (mutex_);
+      closed_ = true;
+      not_full_.notify_all ();
+      not_empty_.notify_all ();
+    }
+
+    bool
+    isClosed () const
+    {
+      boost::unique_lock<boost::mutex> lock (mutex_);
+      return (closed_);
+    }
+
+    // Closed and nothing left to pop
+    bool
+    isDone () const
+    {
+      boost::unique_lock<boost::mutex> lock (mutex_);
+      return (closed_ && items_.empty ());
+    }
+
+  private:
+    size_t capacity_;
+    bool closed_;
+    std::deque<T> items_;
+    mutable boost::mutex mutex_;
+    boost::condition_variable not_full_, not_empty_;
+};
+
+#endif  // PCL_VISUALIZER_BOUNDED_QUEUE_H_
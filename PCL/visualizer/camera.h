@@ -0,0 +1,60 @@
+/* Camera helpers shared by the on-screen and headless code paths                */
+
+#ifndef PCL_VISUALIZER_CAMERA_H_
+#define PCL_VISUALIZER_CAMERA_H_
+
+#include <algorithm>
+#include <cmath>
+
+#include <pcl/visualization/pcl_visualizer.h>
+
+// -------------------------------------------------------------------
+// -----Same camera as PCLVisualizer::initCameraParameters() gives-----
+// -------------------------------------------------------------------
+// At the origin looking down +z with y up, for a window of the given size.
+inline pcl::visualization::Camera
+getDefaultCamera (int width, int height)
+{
+  pcl::visualization::Camera camera;
+  camera.clip[0] = 0.01;
+  camera.clip[1] = 1000.01;
+  camera.focal[0] = 0.0;
+  camera.focal[1] = 0.0;
+  camera.focal[2] = 1.0;
+  camera.pos[0] = 0.0;
+  camera.pos[1] = 0.0;
+  camera.pos[2] = 0.0;
+  camera.view[0] = 0.0;
+  camera.view[1] = 1.0;
+  camera.view[2] = 0.0;
+  camera.fovy = 0.8575;
+  camera.window_size[0] = width;
+  camera.window_size[1] = height;
+  camera.window_pos[0] = 0.0;
+  camera.window_pos[1] = 0.0;
+  return (camera);
+}
+
+// Moves the camera along its view direction so the bounding sphere of the box
+// fills the view, keeping its orientation and field of view, as the viewer's
+// resetCamera does
+inline void
+fitCamera (pcl::visualization::Camera& camera, const Eigen::Vector3f& min_pt, const Eigen::Vector3f& max_pt)
+{
+  Eigen::Vector3d dir (camera.focal[0] - camera.pos[0], camera.focal[1] - camera.pos[1], camera.focal[2] - camera.pos[2]);
+  if (!(dir.norm () > 0))
+    dir = Eigen::Vector3d (0.0, 0.0, 1.0);
+  dir.normalize ();
+  Eigen::Vector3d center = ((min_pt + max_pt) * 0.5f).cast<double> ();
+  double radius = std::max (0.5 * (max_pt - min_pt).cast<double> ().norm (), 1e-6);
+  double distance = radius / std::sin (camera.fovy * 0.5);
+  for (int i = 0; i < 3; ++i)
+  {
+    camera.focal[i] = center[i];
+    camera.pos[i] = center[i] - dir[i] * distance;
+  }
+  camera.clip[0] = std::max (distance - radius, distance * 0.001);
+  camera.clip[1] = distance + radius;
+}
+
+#endif  // PCL_VISUALIZER_CAMERA_H_
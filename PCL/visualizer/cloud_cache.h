@@ -0,0 +1,261 @@
+/* Binary sidecar cache for clouds parsed from text files                        */
+/* <file>.pvcache holds a fixed header followed by the raw point records, so a   */
+/* later run can map it and copy the points into the cloud without parsing      */
+
+#ifndef PCL_VISUALIZER_CLOUD_CACHE_H_
+#define PCL_VISUALIZER_CLOUD_CACHE_H_
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <stdint.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/console/time.h>
+
+#include "xyz_loader.h"
+
+// Bump whenever the header or the record layout changes
+const uint32_t CLOUD_CACHE_VERSION = 1;
+const uint32_t CLOUD_CACHE_POINT_XYZ = 1;
+const uint32_t CLOUD_CACHE_POINT_XYZI = 2;
+const uint32_t CLOUD_CACHE_POINT_XYZRGB = 3;
+const char CLOUD_CACHE_MAGIC[8] = { 'P', 'C', 'L', 'V', 'C', 'A', 'C', 'H' };
+
+struct CloudCacheHeader
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t header_size;   // offset of the first point record
+  uint64_t source_size;
+  int64_t  source_mtime;
+  uint64_t source_hash;
+  uint64_t point_count;
+  uint32_t point_size;
+  uint32_t point_type;
+  uint8_t  reserved[8];
+};
+
+// Record type stored in point_type, so a cache is never read back as a
+// different point type of the same size
+template <typename PointT> struct CloudCachePointType;
+template <> struct CloudCachePointType<pcl::PointXYZ> { static const uint32_t value = CLOUD_CACHE_POINT_XYZ; };
+template <> struct CloudCachePointType<pcl::PointXYZI> { static const uint32_t value = CLOUD_CACHE_POINT_XYZI; };
+template <> struct CloudCachePointType<pcl::PointXYZRGB> { static const uint32_t value = CLOUD_CACHE_POINT_XYZRGB; };
+
+// What a cache entry has to match to be used for a given source file
+struct CloudCacheKey
+{
+  uint64_t size;
+  int64_t  mtime;
+  uint64_t hash;
+};
+
+
+inline std::string
+getCachePath (const std::string& source)
+{
+  return (source + ".pvcache");
+}
+
+
+// -------------------------------------------------------
+// -----Content hash over a sample of the source file-----
+// -------------------------------------------------------
+// Hashing all of a multi-GB file would cost as much disk time as parsing it,
+// so only 64 evenly spaced 64 KiB blocks (including the first and the last
+// one) are hashed. Together with size and mtime this catches edits in place.
+inline uint64_t
+hashBytes (const char* data, size_t size, uint64_t hash)
+{
+  const uint64_t prime = 0x100000001b3ULL;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8)
+  {
+    uint64_t word;
+    std::memcpy (&word, data + i, 8);
+    hash = (hash ^ word) * prime;
+    hash ^= hash >> 29;
+  }
+  for (; i < size; ++i)
+    hash = (hash ^ static_cast<unsigned char> (data[i])) * prime;
+  return (hash);
+}
+
+inline uint64_t
+hashSampledContent (const char* data, size_t size)
+{
+  const size_t block = 64 << 10;
+  const size_t samples = 64;
+  uint64_t hash = 0xcbf29ce484222325ULL ^ size;
+  if (size <= block * samples)
+    return (hashBytes (data, size, hash));
+  for (size_t i = 0; i < samples; ++i)
+  {
+    size_t offset = (size - block) / (samples - 1) * i;
+    hash = hashBytes (data + offset, block, hash);
+  }
+  return (hash);
+}
+
+inline bool
+getCacheKey (const std::string& source, CloudCacheKey& key)
+{
+  try
+  {
+    key.size = boost::filesystem::file_size (source);
+    key.mtime = static_cast<int64_t> (boost::filesystem::last_write_time (source));
+    key.hash = 0;
+    if (key.size > 0)
+    {
+      boost::iostreams::mapped_file_source file (source);
+      key.hash = hashSampledContent (file.data (), file.size ());
+    }
+  }
+  catch (const std::exception&)
+  {
+    return (false);
+  }
+  return (true);
+}
+
+
+// ------------------------------------
+// -----Read a cache entry, if valid-----
+// ------------------------------------
+template <typename PointT> bool
+readCloudCache (const std::string& source, const CloudCacheKey& key, pcl::PointCloud<PointT>& cloud)
+{
+  std::string path = getCachePath (source);
+  if (!boost::filesystem::exists (path))
+    return (false);
+
+  pcl::console::TicToc tt;
+  tt.tic ();
+  boost::iostreams::mapped_file_source file;
+  try
+  {
+    file.open (path);
+  }
+  catch (const std::exception&)
+  {
+    return (false);
+  }
+
+  CloudCacheHeader header;
+  if (file.size () < sizeof (header))
+    return (false);
+  std::memcpy (&header, file.data (), sizeof (header));
+  if (std::memcmp (header.magic, CLOUD_CACHE_MAGIC, sizeof (header.magic)) != 0 ||
+      header.version != CLOUD_CACHE_VERSION ||
+      header.point_type != CloudCachePointType<PointT>::value || header.point_size != sizeof (PointT) ||
+      header.header_size < sizeof (header) ||
+      file.size () != header.header_size + header.point_count * header.point_size)
+  {
+    std::cerr << "Ignoring incompatible cache " << path << "\n";
+    return (false);
+  }
+  if (header.source_size != key.size || header.source_mtime != key.mtime || header.source_hash != key.hash)
+  {
+    std::cerr << "Cache " << path << " is stale, rebuilding it\n";
+    return (false);
+  }
+
+  cloud.points.resize (header.point_count);
+  const char* records = file.data () + header.header_size;
+  char* out = reinterpret_cast<char*> (cloud.points.empty () ? NULL : &cloud.points[0]);
+  const size_t bytes = header.point_count * header.point_size;
+  const int chunks = getNumberOfThreads () * 4;
+#pragma omp parallel for
+  for (int i = 0; i < chunks; ++i)
+  {
+    size_t begin = bytes * i / chunks, end = bytes * (i + 1) / chunks;
+    std::memcpy (out + begin, records + begin, end - begin);
+  }
+  cloud.width = static_cast<uint32_t> (header.point_count);
+  cloud.height = 1;
+  cloud.is_dense = true;
+
+  double ms = tt.toc ();
+  std::cerr << "Loaded " << header.point_count << " points from cache " << path << " in " << ms << " ms: "
+            << bytes / (1024.0 * 1024.0) / (ms * 0.001 + 1e-9) << " MB/s\n";
+  return (true);
+}
+
+
+// ---------------------------
+// -----Write a cache entry-----
+// ---------------------------
+// Written to a temporary name first, so an interrupted run never leaves a
+// truncated entry that looks valid.
+template <typename PointT> bool
+writeCloudCache (const std::string& source, const CloudCacheKey& key, const pcl::PointCloud<PointT>& cloud)
+{
+  CloudCacheHeader header;
+  std::memset (&header, 0, sizeof (header));
+  std::memcpy (header.magic, CLOUD_CACHE_MAGIC, sizeof (header.magic));
+  header.version = CLOUD_CACHE_VERSION;
+  header.header_size = 64;
+  header.source_size = key.size;
+  header.source_mtime = key.mtime;
+  header.source_hash = key.hash;
+  header.point_count = cloud.points.size ();
+  header.point_size = sizeof (PointT);
+  header.point_type = CloudCachePointType<PointT>::value;
+
+  std::string path = getCachePath (source);
+  std::string tmp = path + ".tmp";
+  {
+    std::ofstream out (tmp.c_str (), std::ios::binary | std::ios::trunc);
+    char padding[64] = { 0 };
+    out.write (reinterpret_cast<const char*> (&header), sizeof (header));
+    out.write (padding, header.header_size - sizeof (header));
+    if (!cloud.points.empty ())
+      out.write (reinterpret_cast<const char*> (&cloud.points[0]), header.point_count * header.point_size);
+    if (!out)
+    {
+      out.close ();
+      std::remove (tmp.c_str ());
+      std::cerr << "Could not write cache " << path << std::endl;
+      return (false);
+    }
+  }
+  boost::system::error_code ec;
+  boost::filesystem::rename (tmp, path, ec);
+  if (ec)
+  {
+    std::remove (tmp.c_str ());
+    std::cerr << "Could not write cache " << path << ": " << ec.message () << std::endl;
+    return (false);
+  }
+  return (true);
+}
+
+
+// -------------------------------------------------------------
+// -----Load a text file, going through the sidecar if we can-----
+// -------------------------------------------------------------
+template <typename PointT> bool
+loadXYZFileCached (const std::string& filename, pcl::PointCloud<PointT>& cloud, bool use_cache = true)
+{
+  CloudCacheKey key;
+  if (!use_cache || !getCacheKey (filename, key))
+    return (loadXYZFile (filename, cloud));
+
+  if (readCloudCache (filename, key, cloud))
+    return (true);
+  if (!loadXYZFile (filename, cloud))
+    return (false);
+  if (writeCloudCache (filename, key, cloud))
+    std::cerr << "Wrote cache " << getCachePath (filename) << "\n";
+  return (true);
+}
+
+#endif  // PCL_VISUALIZER_CLOUD_CACHE_H_
@@ -0,0 +1,332 @@
+/* --diff: distance from every point to the nearest point of a reference cloud,  */
+/* searched in parallel and shown as a colour ramp                               */
+
+#ifndef PCL_VISUALIZER_CLOUD_DIFF_H_
+#define PCL_VISUALIZER_CLOUD_DIFF_H_
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/console/time.h>
+#include <pcl/search/kdtree.h>
+#include <pcl/visualization/point_cloud_color_handlers.h>
+
+#include <vtkSmartPointer.h>
+#include <vtkUnsignedCharArray.h>
+
+#include "field_colour.h"
+#include "xyz_loader.h"
+
+static const int DIFF_HISTOGRAM_BINS = 4096;
+
+
+// -----------------------------------------------------------
+// -----Nearest-neighbour search over the reference cloud-----
+// -----------------------------------------------------------
+// A single KD-tree over tens of millions of points takes longer to build
+// than all the searches take to run, and the build is sequential. The
+// reference is cut into slabs of about equal count along its longest axis
+// instead, one tree per slab, built in parallel. A search starts in the
+// query's slab and moves on to a neighbouring one only while that slab is
+// closer than the nearest point found so far, so results are exact.
+class ReferenceForest
+{
+  public:
+    typedef pcl::search::KdTree<pcl::PointXYZ> Tree;
+
+    ReferenceForest (const pcl::PointCloud<pcl::PointXYZ>& reference) : axis_ (0), size_ (0)
+    {
+      pcl::console::TicToc tt;
+      tt.tic ();
+      const int n = static_cast<int> (reference.points.size ());
+      const int chunks = getNumberOfThreads ();
+
+      // Bounds of the finite points, then the longest axis
+      Eigen::Array3f min_pt = Eigen::Array3f::Constant (std::numeric_limits<float>::max ());
+      Eigen::Array3f max_pt = Eigen::Array3f::Constant (-std::numeric_limits<float>::max ());
+#pragma omp parallel for
+      for (int c = 0; c < chunks; ++c)
+      {
+        Eigen::Array3f lo = Eigen::Array3f::Constant (std::numeric_limits<float>::max ());
+        Eigen::Array3f hi = Eigen::Array3f::Constant (-std::numeric_limits<float>::max ());
+        int begin = static_cast<int> (static_cast<long long> (n) * c / chunks);
+        int end = static_cast<int> (static_cast<long long> (n) * (c + 1) / chunks);
+        for (int i = begin; i < end; ++i)
+          if (pcl::isFinite (reference.points[i]))
+          {
+            lo = lo.min (reference.points[i].getArray3fMap ());
+            hi = hi.max (reference.points[i].getArray3fMap ());
+          }
+#pragma omp critical
+        {
+          min_pt = min_pt.min (lo);
+          max_pt = max_pt.max (hi);
+        }
+      }
+      if (!(min_pt[0] <= max_pt[0]))
+        return;
+      (max_pt - min_pt).maxCoeff (&axis_);
+
+      // Slab edges where the running count of a fine histogram passes each
+      // equal share; small clouds get a single tree
+      const int slabs = (n < 200000 ? 1 : chunks);
+      const float low = min_pt[axis_], width = std::max (max_pt[axis_] - low, 1e-30f);
+      std::vector<size_t> histogram (DIFF_HISTOGRAM_BINS, 0);
+#pragma omp parallel
+      {
+        std::vector<size_t> mine (DIFF_HISTOGRAM_BINS, 0);
+#pragma omp for
+        for (int i = 0; i < n; ++i)
+          if (pcl::isFinite (reference.points[i]))
+            ++mine[getBin (reference.points[i].data[axis_], low, width)];
+#pragma omp critical
+        for (int b = 0; b < DIFF_HISTOGRAM_BINS; ++b)
+          histogram[b] += mine[b];
+      }
+      size_t finite = 0;
+      for (int b = 0; b < DIFF_HISTOGRAM_BINS; ++b)
+        finite += histogram[b];
+      edges_.push_back (-std::numeric_limits<float>::max ());
+      size_t count = 0;
+      for (int b = 0; b < DIFF_HISTOGRAM_BINS - 1 && static_cast<int> (edges_.size ()) < slabs; ++b)
+      {
+        count += histogram[b];
+        if (count * slabs >= finite * edges_.size ())
+          edges_.push_back (low + width * (b + 1) / DIFF_HISTOGRAM_BINS);
+      }
+
+      // Scatter the points into their slabs, chunk by chunk, at offsets from
+      // a first counting pass
+      const int slab_count = static_cast<int> (edges_.size ());
+      std::vector<size_t> offsets (static_cast<size_t> (chunks) * slab_count + 1, 0);
+#pragma omp parallel for
+      for (int c = 0; c < chunks; ++c)
+      {
+        int begin = static_cast<int> (static_cast<long long> (n) * c / chunks);
+        int end = static_cast<int> (static_cast<long long> (n) * (c + 1) / chunks);
+        for (int i = begin; i < end; ++i)
+          if (pcl::isFinite (reference.points[i]))
+            ++offsets[static_cast<size_t> (getSlab (reference.points[i].data[axis_])) * chunks + c + 1];
+      }
+      for (size_t i = 1; i < offsets.size (); ++i)
+        offsets[i] += offsets[i - 1];
+      trees_.resize (slab_count);
+      std::vector<pcl::PointCloud<pcl::PointXYZ>::Ptr> clouds (slab_count);
+      for (int s = 0; s < slab_count; ++s)
+      {
+        clouds[s].reset (new pcl::PointCloud<pcl::PointXYZ>);
+        clouds[s]->points.resize (offsets[static_cast<size_t> (s + 1) * chunks] - offsets[static_cast<size_t> (s) * chunks]);
+        clouds[s]->width = static_cast<uint32_t> (clouds[s]->points.size ());
+        clouds[s]->height = 1;
+      }
+#pragma omp parallel for
+      for (int c = 0; c < chunks; ++c)
+      {
+        std::vector<size_t> out (slab_count);
+        for (int s = 0; s < slab_count; ++s)
+          out[s] = offsets[static_cast<size_t> (s) * chunks + c] - offsets[static_cast<size_t> (s) * chunks];
+        int begin = static_cast<int> (static_cast<long long> (n) * c / chunks);
+        int end = static_cast<int> (static_cast<long long> (n) * (c + 1) / chunks);
+        for (int i = begin; i < end; ++i)
+          if (pcl::isFinite (reference.points[i]))
+          {
+            int s = getSlab (reference.points[i].data[axis_]);
+            clouds[s]->points[out[s]++] = reference.points[i];
+          }
+      }
+
+#pragma omp parallel for schedule (dynamic)
+      for (int s = 0; s < slab_count; ++s)
+        if (!clouds[s]->points.empty ())
+        {
+          trees_[s].reset (new Tree (false));
+          trees_[s]->setInputCloud (clouds[s]);
+        }
+      size_ = finite;
+      std::cout << "Built " << slab_count << " KD-trees over " << finite << " reference points in " << tt.toc ()
+                << " ms\n";
+    }
+
+    size_t
+    size () const
+    {
+      return (size_);
+    }
+
+    // Distance to the nearest reference point; k and sqr_distances are the
+    // caller's scratch space, so threads do not share them
+    float
+    nearestDistance (const pcl::PointXYZ& p, std::vector<int>& k, std::vector<float>& sqr_distances) const
+    {
+      if (trees_.empty () || !pcl::isFinite (p))
+        return (std::numeric_limits<float>::quiet_NaN ());
+      const int slab = getSlab (p.data[axis_]);
+      float best = std::numeric_limits<float>::max ();
+      search (slab, p, best, k, sqr_distances);
+      for (int s = slab - 1; s >= 0; --s)
+      {
+        float gap = p.data[axis_] - edges_[s + 1];
+        if (gap * gap >= best)
+          break;
+        search (s, p, best, k, sqr_distances);
+      }
+      for (int s = slab + 1; s < static_cast<int> (trees_.size ()); ++s)
+      {
+        float gap = edges_[s] - p.data[axis_];
+        if (gap * gap >= best)
+          break;
+        search (s, p, best, k, sqr_distances);
+      }
+      return (std::sqrt (best));
+    }
+
+  private:
+    static int
+    getBin (float value, float low, float width)
+    {
+      int bin = static_cast<int> ((value - low) / width * DIFF_HISTOGRAM_BINS);
+      return (std::max (0, std::min (DIFF_HISTOGRAM_BINS - 1, bin)));
+    }
+
+    // Slab s holds edges_[s] <= value < edges_[s + 1]
+    int
+    getSlab (float value) const
+    {
+      return (static_cast<int> (std::upper_bound (edges_.begin () + 1, edges_.end (), value) - edges_.begin ()) - 1);
+    }
+
+    void
+    search (int slab, const pcl::PointXYZ& p, float& best, std::vector<int>& k, std::vector<float>& sqr_distances) const
+    {
+      if (trees_[slab] && trees_[slab]->nearestKSearch (p, 1, k, sqr_distances) > 0)
+        best = std::min (best, sqr_distances[0]);
+    }
+
+    int axis_;
+    size_t size_;
+    std::vector<float> edges_;
+    std::vector<Tree::Ptr> trees_;
+};
+
+
+// --------------------------------------------------------
+// -----Distance of every point to the reference cloud-----
+// --------------------------------------------------------
+// NaN for points that are not finite
+inline void
+computeCloudDistances (const pcl::PointCloud<pcl::PointXYZ>& cloud, const ReferenceForest& reference,
+                       std::vector<float>& distances)
+{
+  pcl::console::TicToc tt;
+  tt.tic ();
+  const int n = static_cast<int> (cloud.points.size ());
+  distances.resize (n);
+#pragma omp parallel
+  {
+    std::vector<int> k (1);
+    std::vector<float> sqr_distances (1);
+#pragma omp for schedule (dynamic, 4096)
+    for (int i = 0; i < n; ++i)
+      distances[i] = reference.nearestDistance (cloud.points[i], k, sqr_distances);
+  }
+  double ms = tt.toc ();
+  std::cout << "Found " << n << " nearest neighbours in " << ms << " ms: " << n / (ms * 0.001 + 1e-9)
+            << " points/s on " << getNumberOfThreads () << " threads\n";
+}
+
+// Mean, RMS and percentiles of the finite distances, printed; returns the
+// 99th percentile, which the colour ramp tops out at by default
+inline float
+summariseDistances (const std::vector<float>& distances)
+{
+  std::vector<float> finite;
+  finite.reserve (distances.size ());
+  double sum = 0.0, sum_sq = 0.0;
+  for (size_t i = 0; i < distances.size (); ++i)
+    if (pcl_isfinite (distances[i]))
+    {
+      finite.push_back (distances[i]);
+      sum += distances[i];
+      sum_sq += static_cast<double> (distances[i]) * distances[i];
+    }
+  if (finite.empty ())
+    return (0.0f);
+  const double quantiles[4] = { 0.5, 0.95, 0.99, 1.0 };
+  float values[4];
+  for (int i = 0; i < 4; ++i)
+  {
+    std::vector<float>::iterator nth = finite.begin () + std::min (finite.size () - 1, static_cast<size_t> (quantiles[i] * finite.size ()));
+    std::nth_element (finite.begin (), nth, finite.end ());
+    values[i] = *nth;
+  }
+  std::cout << "Distance to reference: mean " << sum / finite.size () << ", RMS " << std::sqrt (sum_sq / finite.size ())
+            << ", median " << values[0] << ", 95% " << values[1] << ", 99% " << values[2] << ", max " << values[3] << "\n";
+  return (values[2]);
+}
+
+
+// The ramp of --colour-by over [0, max]; points past max stay red
+class PointCloudColorHandlerDistance : public pcl::visualization::PointCloudColorHandler<pcl::PointXYZ>
+{
+  public:
+    PointCloudColorHandlerDistance (const PointCloudConstPtr& cloud, const boost::shared_ptr<const std::vector<float> >& distances,
+                                    float max) :
+      pcl::visualization::PointCloudColorHandler<pcl::PointXYZ> (cloud), distances_ (distances), max_ (max)
+    {
+      capable_ = (distances && distances->size () == cloud->points.size ());
+    }
+
+    std::string
+    getName () const
+    {
+      return ("PointCloudColorHandlerDistance");
+    }
+
+    std::string
+    getFieldName () const
+    {
+      return ("distance");
+    }
+
+    // Colours the points the XYZ geometry handler keeps: all of a dense
+    // cloud, the finite ones otherwise
+    bool
+    getColor (vtkSmartPointer<vtkDataArray>& scalars) const
+    {
+      if (!capable_ || !cloud_)
+        return (false);
+      if (!scalars)
+        scalars = vtkSmartPointer<vtkUnsignedCharArray>::New ();
+      vtkUnsignedCharArray* colours = reinterpret_cast<vtkUnsignedCharArray*> (&(*scalars));
+      colours->SetNumberOfComponents (3);
+      const std::vector<float>& d = *distances_;
+      const float scale = (max_ > 0 ? 4.0f / max_ : 0.0f);
+      vtkIdType j = 0;
+      for (size_t i = 0; i < cloud_->points.size (); ++i)
+        if (cloud_->is_dense || pcl::isFinite (cloud_->points[i]))
+          ++j;
+      colours->SetNumberOfTuples (j);
+      unsigned char* rgb = colours->GetPointer (0);
+      j = 0;
+      for (size_t i = 0; i < cloud_->points.size (); ++i)
+      {
+        if (!cloud_->is_dense && !pcl::isFinite (cloud_->points[i]))
+          continue;
+        getRampColour (pcl_isfinite (d[i]) ? d[i] * scale : 0.0f, &rgb[3 * j++]);
+      }
+      return (true);
+    }
+
+  private:
+    boost::shared_ptr<const std::vector<float> > distances_;
+    float max_;
+};
+
+#endif  // PCL_VISUALIZER_CLOUD_DIFF_H_
@@ -0,0 +1,271 @@
+/* Quantised point storage: every block keeps its points as 16 or 21 bit steps   */
+/* from its own origin, and is turned back into floats only when it is read      */
+
+#ifndef PCL_VISUALIZER_COMPACT_CLOUD_H_
+#define PCL_VISUALIZER_COMPACT_CLOUD_H_
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#if !defined(PCL_VISUALIZER_HAS_SSE2) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define PCL_VISUALIZER_HAS_SSE2
+#endif
+
+static const int COMPACT_SHORT_BITS = 16;
+static const int COMPACT_PACKED_BITS = 21;
+
+// One run of points quantised together. 16 bit blocks store all x, then all
+// y, then all z; 21 bit blocks store x | y << 21 | z << 42 per point.
+struct CompactBlock
+{
+  float origin[3];
+  float step;
+  size_t begin;               // position of the block's first point
+  size_t size;
+  size_t offset;              // into the 16 or the 64 bit words
+  int bits;
+};
+
+
+class CompactCloud
+{
+  public:
+    CompactCloud () : size_ (0) {}
+
+    // Quantises the points order[begin, end) of every range into one block,
+    // with steps of about twice precision, so no coordinate moves by more
+    // than precision; the steps are shortened by what float rounding costs
+    // at the block's magnitude. Returns false if a block spans more than
+    // 2^21 steps, or if precision is below what floats hold there.
+    // Non-finite points, which the loaders never produce, end up at the
+    // block origin.
+    bool
+    build (const pcl::PointCloud<pcl::PointXYZ>& cloud, const std::vector<boost::uint32_t>& order,
+           const std::vector<std::pair<size_t, size_t> >& ranges, float precision)
+    {
+      const int n = static_cast<int> (ranges.size ());
+      blocks_.resize (n);
+      bool fits = true;
+#pragma omp parallel for schedule (dynamic, 64)
+      for (int b = 0; b < n; ++b)
+      {
+        CompactBlock& block = blocks_[b];
+        float min_pt[3], max_pt[3];
+        for (int k = 0; k < 3; ++k)
+        {
+          min_pt[k] = std::numeric_limits<float>::max ();
+          max_pt[k] = -std::numeric_limits<float>::max ();
+        }
+        for (size_t i = ranges[b].first; i < ranges[b].second; ++i)
+          for (int k = 0; k < 3; ++k)
+            if (pcl_isfinite (cloud.points[order[i]].data[k]))
+            {
+              min_pt[k] = std::min (min_pt[k], cloud.points[order[i]].data[k]);
+              max_pt[k] = std::max (max_pt[k], cloud.points[order[i]].data[k]);
+            }
+        float magnitude = 0.0f;
+        for (int k = 0; k < 3; ++k)
+        {
+          block.origin[k] = (min_pt[k] <= max_pt[k] ? min_pt[k] : 0.0f);
+          if (min_pt[k] <= max_pt[k])
+            magnitude = std::max (magnitude, std::max (std::fabs (min_pt[k]), std::fabs (max_pt[k])));
+        }
+        const float step = 2.0f * (precision - 2.0f * std::numeric_limits<float>::epsilon () * magnitude);
+        double steps = (step > 0.0f ? 0.0 : std::numeric_limits<double>::max ());
+        for (int k = 0; k < 3; ++k)
+          if (min_pt[k] <= max_pt[k] && step > 0.0f)
+            steps = std::max (steps, (static_cast<double> (max_pt[k]) - min_pt[k]) / step);
+        block.step = step;
+        block.begin = ranges[b].first;
+        block.size = ranges[b].second - ranges[b].first;
+        block.bits = (steps + 1.0 < (1 << COMPACT_SHORT_BITS) ? COMPACT_SHORT_BITS : COMPACT_PACKED_BITS);
+        if (steps + 1.0 >= (1 << COMPACT_PACKED_BITS))
+        {
+#pragma omp critical
+          fits = false;
+        }
+      }
+      if (!fits)
+        return (false);
+
+      size_t shorts = 0, words = 0;
+      for (int b = 0; b < n; ++b)
+      {
+        CompactBlock& block = blocks_[b];
+        if (block.bits == COMPACT_SHORT_BITS)
+        {
+          block.offset = shorts;
+          shorts += 3 * block.size;
+        }
+        else
+        {
+          block.offset = words;
+          words += block.size;
+        }
+      }
+      std::vector<boost::uint16_t> (shorts).swap (shorts_);
+      std::vector<boost::uint64_t> (words).swap (words_);
+
+#pragma omp parallel for schedule (dynamic, 64)
+      for (int b = 0; b < n; ++b)
+      {
+        const CompactBlock& block = blocks_[b];
+        const double inv_step = 1.0 / block.step;
+        const boost::uint32_t top = (1u << block.bits) - 1;
+        for (size_t j = 0; j < block.size; ++j)
+        {
+          const pcl::PointXYZ& p = cloud.points[order[block.begin + j]];
+          boost::uint32_t q[3];
+          for (int k = 0; k < 3; ++k)
+          {
+            double offset = (pcl_isfinite (p.data[k]) ? static_cast<double> (p.data[k]) - block.origin[k] : 0.0);
+            q[k] = std::min (top, static_cast<boost::uint32_t> (offset * inv_step + 0.5));
+          }
+          if (block.bits == COMPACT_SHORT_BITS)
+            for (int k = 0; k < 3; ++k)
+              shorts_[block.offset + k * block.size + j] = static_cast<boost::uint16_t> (q[k]);
+          else
+            words_[block.offset + j] = static_cast<boost::uint64_t> (q[0]) |
+                                       (static_cast<boost::uint64_t> (q[1]) << COMPACT_PACKED_BITS) |
+                                       (static_cast<boost::uint64_t> (q[2]) << (2 * COMPACT_PACKED_BITS));
+        }
+      }
+      size_ = order.size ();
+      return (true);
+    }
+
+    size_t
+    size () const
+    {
+      return (size_);
+    }
+
+    size_t
+    getBlockCount (int bits) const
+    {
+      size_t count = 0;
+      for (size_t b = 0; b < blocks_.size (); ++b)
+        count += (blocks_[b].bits == bits);
+      return (count);
+    }
+
+    // Bytes held for the points and their blocks
+    size_t
+    getMemoryBytes () const
+    {
+      return (shorts_.capacity () * sizeof (boost::uint16_t) + words_.capacity () * sizeof (boost::uint64_t) +
+              blocks_.capacity () * sizeof (CompactBlock));
+    }
+
+    size_t
+    getBlockIndex (size_t index) const
+    {
+      size_t lo = 0, hi = blocks_.size ();
+      while (hi - lo > 1)
+      {
+        size_t mid = (lo + hi) / 2;
+        if (blocks_[mid].begin <= index)
+          lo = mid;
+        else
+          hi = mid;
+      }
+      return (lo);
+    }
+
+    // Point index of the whole store, i.e. in block order
+    pcl::PointXYZ
+    getPoint (size_t index) const
+    {
+      const CompactBlock& block = blocks_[getBlockIndex (index)];
+      const size_t j = index - block.begin;
+      boost::uint32_t q[3];
+      if (block.bits == COMPACT_SHORT_BITS)
+        for (int k = 0; k < 3; ++k)
+          q[k] = shorts_[block.offset + k * block.size + j];
+      else
+        for (int k = 0; k < 3; ++k)
+          q[k] = static_cast<boost::uint32_t> (words_[block.offset + j] >> (k * COMPACT_PACKED_BITS)) &
+                 ((1u << COMPACT_PACKED_BITS) - 1);
+      pcl::PointXYZ p;
+      p.x = block.origin[0] + static_cast<float> (q[0]) * block.step;
+      p.y = block.origin[1] + static_cast<float> (q[1]) * block.step;
+      p.z = block.origin[2] + static_cast<float> (q[2]) * block.step;
+      return (p);
+    }
+
+    const CompactBlock&
+    getBlock (int b) const
+    {
+      return (blocks_[b]);
+    }
+
+    // The first count points of block b, as floats
+    void
+    decode (int b, size_t count, pcl::PointXYZ* out) const
+    {
+      const CompactBlock& block = blocks_[b];
+      count = std::min (count, block.size);
+      size_t j = 0;
+      if (block.bits == COMPACT_SHORT_BITS)
+      {
+        const boost::uint16_t* xs = &shorts_[block.offset];
+        const boost::uint16_t* ys = xs + block.size;
+        const boost::uint16_t* zs = ys + block.size;
+#if defined(PCL_VISUALIZER_HAS_SSE2)
+        // Four points at a time: widen the steps of each axis to floats,
+        // scale and offset them, then transpose into x y z 1 records
+        const __m128i zero = _mm_setzero_si128 ();
+        const __m128 step = _mm_set1_ps (block.step);
+        const __m128 ox = _mm_set1_ps (block.origin[0]), oy = _mm_set1_ps (block.origin[1]), oz = _mm_set1_ps (block.origin[2]);
+        for (; j + 4 <= count; j += 4)
+        {
+          __m128 x = _mm_add_ps (ox, _mm_mul_ps (_mm_cvtepi32_ps (_mm_unpacklo_epi16 (
+                                   _mm_loadl_epi64 (reinterpret_cast<const __m128i*> (xs + j)), zero)), step));
+          __m128 y = _mm_add_ps (oy, _mm_mul_ps (_mm_cvtepi32_ps (_mm_unpacklo_epi16 (
+                                   _mm_loadl_epi64 (reinterpret_cast<const __m128i*> (ys + j)), zero)), step));
+          __m128 z = _mm_add_ps (oz, _mm_mul_ps (_mm_cvtepi32_ps (_mm_unpacklo_epi16 (
+                                   _mm_loadl_epi64 (reinterpret_cast<const __m128i*> (zs + j)), zero)), step));
+          __m128 w = _mm_set1_ps (1.0f);
+          _MM_TRANSPOSE4_PS (x, y, z, w);
+          _mm_storeu_ps (out[j].data, x);
+          _mm_storeu_ps (out[j + 1].data, y);
+          _mm_storeu_ps (out[j + 2].data, z);
+          _mm_storeu_ps (out[j + 3].data, w);
+        }
+#endif
+        for (; j < count; ++j)
+        {
+          out[j].x = block.origin[0] + xs[j] * block.step;
+          out[j].y = block.origin[1] + ys[j] * block.step;
+          out[j].z = block.origin[2] + zs[j] * block.step;
+        }
+      }
+      else
+      {
+        const boost::uint64_t mask = (static_cast<boost::uint64_t> (1) << COMPACT_PACKED_BITS) - 1;
+        const boost::uint64_t* words = &words_[block.offset];
+        for (; j < count; ++j)
+        {
+          out[j].x = block.origin[0] + static_cast<float> (words[j] & mask) * block.step;
+          out[j].y = block.origin[1] + static_cast<float> ((words[j] >> COMPACT_PACKED_BITS) & mask) * block.step;
+          out[j].z = block.origin[2] + static_cast<float> (words[j] >> (2 * COMPACT_PACKED_BITS)) * block.step;
+        }
+      }
+    }
+
+  private:
+    std::vector<CompactBlock> blocks_;
+    std::vector<boost::uint16_t> shorts_;
+    std::vector<boost::uint64_t> words_;
+    size_t size_;
+};
+
+#endif  // PCL_VISUALIZER_COMPACT_CLOUD_H_
@@ -0,0 +1,138 @@
+/* Background decompression of .gz / .zst input into a bounded queue of chunks    */
+
+#ifndef PCL_VISUALIZER_DECOMPRESS_H_
+#define PCL_VISUALIZER_DECOMPRESS_H_
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/version.hpp>
+#include <boost/iostreams/device/file.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#if BOOST_VERSION >= 106700
+#include <boost/iostreams/filter/zstd.hpp>
+#endif
+
+#include "bounded_queue.h"
+
+enum Compression
+{
+  COMPRESSION_NONE,
+  COMPRESSION_GZIP,
+  COMPRESSION_ZSTD
+};
+
+// Decided by the magic bytes, not the file name
+inline Compression
+detectCompression (const std::string& filename)
+{
+  unsigned char magic[4] = { 0, 0, 0, 0 };
+  std::ifstream in (filename.c_str (), std::ios::binary);
+  in.read (reinterpret_cast<char*> (magic), sizeof (magic));
+  if (in.gcount () >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+    return (COMPRESSION_GZIP);
+  if (in.gcount () == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+    return (COMPRESSION_ZSTD);
+  return (COMPRESSION_NONE);
+}
+
+
+// ------------------------------------------------------------------------
+// -----Inflates a file on its own thread, a fixed-size chunk at a time-----
+// ------------------------------------------------------------------------
+// At most depth chunks are queued, so a slow consumer stalls the
+// decompressor instead of letting it fill memory.
+class Decompressor
+{
+  public:
+    typedef boost::shared_ptr<std::vector<char> > Chunk;
+
+    Decompressor (size_t chunk_size = 4 << 20, size_t depth = 4) :
+      chunks_ (depth), chunk_size_ (chunk_size), failed_ (false) {}
+
+    ~Decompressor ()
+    {
+      chunks_.close ();
+      if (thread_.joinable ())
+        thread_.join ();
+    }
+
+    // Returns false if the file is not compressed in a format we can read
+    bool
+    start (const std::string& filename)
+    {
+      Compression compression = detectCompression (filename);
+#if BOOST_VERSION < 106700
+      if (compression == COMPRESSION_ZSTD)
+      {
+        std::cerr << "Reading " << filename << " needs Boost 1.67 or later for zstd support" << std::endl;
+        return (false);
+      }
+#endif
+      if (compression == COMPRESSION_NONE)
+        return (false);
+      thread_ = boost::thread (&Decompressor::run, this, filename, compression);
+      return (true);
+    }
+
+    // Blocks for the next chunk; false once the whole file was handed out
+    bool
+    next (Chunk& chunk)
+    {
+      return (chunks_.pop (chunk));
+    }
+
+    // Only meaningful after next () returned false
+    bool
+    failed () const
+    {
+      return (failed_);
+    }
+
+  private:
+    void
+    run (const std::string& filename, Compression compression)
+    {
+      try
+      {
+        boost::iostreams::filtering_istream in;
+        if (compression == COMPRESSION_GZIP)
+          in.push (boost::iostreams::gzip_decompressor ());
+#if BOOST_VERSION >= 106700
+        else
+          in.push (boost::iostreams::zstd_decompressor ());
+#endif
+        in.push (boost::iostreams::file_source (filename, std::ios::binary));
+        while (in)
+        {
+          Chunk chunk (new std::vector<char> (chunk_size_));
+          in.read (&(*chunk)[0], chunk_size_);
+          chunk->resize (static_cast<size_t> (in.gcount ()));
+          if (chunk->empty ())
+            break;
+          if (!chunks_.push (chunk))
+            return;
+        }
+        if (in.bad ())
+          throw std::ios_base::failure ("read error");
+      }
+      catch (const std::exception& e)
+      {
+        std::cerr << "Could not decompress " << filename << ": " << e.what () << std::endl;
+        failed_ = true;
+      }
+      chunks_.close ();
+    }
+
+    BoundedQueue<Chunk> chunks_;
+    size_t chunk_size_;
+    bool failed_;
+    boost::thread thread_;
+};
+
+#endif  // PCL_VISUALIZER_DECOMPRESS_H_
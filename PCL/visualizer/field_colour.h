@@ -0,0 +1,356 @@
+/* Colour by a field of the points: height, range from the origin or intensity,  */
+/* stretched over the whole cloud and mapped through a 256 entry colour table    */
+
+#ifndef PCL_VISUALIZER_FIELD_COLOUR_H_
+#define PCL_VISUALIZER_FIELD_COLOUR_H_
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <string>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/visualization/point_cloud_color_handlers.h>
+
+#include <vtkSmartPointer.h>
+#include <vtkUnsignedCharArray.h>
+
+#if !defined(PCL_VISUALIZER_HAS_SSE2) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define PCL_VISUALIZER_HAS_SSE2
+#endif
+
+#include "xyz_loader.h"
+
+enum ColourField
+{
+  COLOUR_FIELD_NONE,
+  COLOUR_FIELD_Z,
+  COLOUR_FIELD_RANGE,         // distance to the origin
+  COLOUR_FIELD_INTENSITY
+};
+
+static const int COLOUR_FIELD_COUNT = 4;
+static const int COLOUR_TABLE_SIZE = 256;
+
+// Values a field is coloured over. It is worked out once for the whole
+// cloud, so a point keeps its colour while the points drawn change.
+struct FieldRange
+{
+  FieldRange () : lo (0.0f), hi (0.0f), known (false) {}
+
+  float lo, hi;
+  bool known;
+};
+
+inline bool
+parseColourField (const std::string& name, ColourField& field)
+{
+  if (name == "z")
+    field = COLOUR_FIELD_Z;
+  else if (name == "range")
+    field = COLOUR_FIELD_RANGE;
+  else if (name == "intensity")
+    field = COLOUR_FIELD_INTENSITY;
+  else
+  {
+    std::cerr << "Unknown colour field '" << name << "'; use z, range or intensity" << std::endl;
+    return (false);
+  }
+  return (true);
+}
+
+inline const char*
+getColourFieldName (ColourField field)
+{
+  switch (field)
+  {
+    case COLOUR_FIELD_Z: return ("z");
+    case COLOUR_FIELD_RANGE: return ("range");
+    case COLOUR_FIELD_INTENSITY: return ("intensity");
+    default: return ("none");
+  }
+}
+
+// Blue through cyan, green and yellow to red for t in [0, 4], one quarter
+// of the ramp per colour pair
+inline void
+getRampColour (float t, unsigned char* rgb)
+{
+  t = std::max (0.0f, std::min (4.0f, t));
+  int segment = std::min (3, static_cast<int> (t));
+  unsigned char up = static_cast<unsigned char> ((t - segment) * 255.0f + 0.5f);
+  unsigned char down = static_cast<unsigned char> (255 - up);
+  const unsigned char ramp[4][3] = { { 0, up, 255 }, { 0, 255, down }, { up, 255, 0 }, { 255, down, 0 } };
+  rgb[0] = ramp[segment][0];
+  rgb[1] = ramp[segment][1];
+  rgb[2] = ramp[segment][2];
+}
+
+template <typename PointT> struct HasIntensity { static const bool value = false; };
+template <> struct HasIntensity<pcl::PointXYZI> { static const bool value = true; };
+
+template <typename PointT> inline float
+getIntensity (const PointT&)
+{
+  return (0.0f);
+}
+
+inline float
+getIntensity (const pcl::PointXYZI& p)
+{
+  return (p.intensity);
+}
+
+template <typename PointT> inline float
+getFieldValue (const PointT& p, ColourField field)
+{
+  if (field == COLOUR_FIELD_Z)
+    return (p.z);
+  if (field == COLOUR_FIELD_RANGE)
+    return (std::sqrt (p.x * p.x + p.y * p.y + p.z * p.z));
+  return (getIntensity (p));
+}
+
+#if defined(PCL_VISUALIZER_HAS_SSE2)
+// The field of the four points from p on. Every point type here starts with
+// x y z and a pad, so the coordinates come in as four rows to transpose.
+template <typename PointT> inline __m128
+getFieldValues (const PointT* p, ColourField field)
+{
+  if (field == COLOUR_FIELD_INTENSITY)
+    return (_mm_set_ps (getIntensity (p[3]), getIntensity (p[2]), getIntensity (p[1]), getIntensity (p[0])));
+  __m128 x = _mm_loadu_ps (p[0].data), y = _mm_loadu_ps (p[1].data);
+  __m128 z = _mm_loadu_ps (p[2].data), w = _mm_loadu_ps (p[3].data);
+  _MM_TRANSPOSE4_PS (x, y, z, w);
+  if (field == COLOUR_FIELD_Z)
+    return (z);
+  return (_mm_sqrt_ps (_mm_add_ps (_mm_add_ps (_mm_mul_ps (x, x), _mm_mul_ps (y, y)), _mm_mul_ps (z, z))));
+}
+#endif
+
+
+// ------------------------------------------
+// -----Smallest and largest field value-----
+// ------------------------------------------
+// Over the finite values of the finite points; one chunk per thread, merged
+// at the end. Returns false if there is none.
+template <typename PointT> bool
+computeFieldRange (const pcl::PointCloud<PointT>& cloud, ColourField field, float& lo, float& hi)
+{
+  const int n = static_cast<int> (cloud.points.size ());
+  const int chunks = getNumberOfThreads ();
+  lo = std::numeric_limits<float>::max ();
+  hi = -std::numeric_limits<float>::max ();
+#pragma omp parallel for
+  for (int c = 0; c < chunks; ++c)
+  {
+    const int begin = static_cast<int> (static_cast<long long> (n) * c / chunks);
+    const int end = static_cast<int> (static_cast<long long> (n) * (c + 1) / chunks);
+    float chunk_lo = std::numeric_limits<float>::max (), chunk_hi = -std::numeric_limits<float>::max ();
+    int i = begin;
+#if defined(PCL_VISUALIZER_HAS_SSE2)
+    if (cloud.is_dense)
+    {
+      // min and max return their second operand when either is NaN, which
+      // keeps NaN values out
+      __m128 v_lo = _mm_set1_ps (chunk_lo), v_hi = _mm_set1_ps (chunk_hi);
+      for (; i + 4 <= end; i += 4)
+      {
+        __m128 v = getFieldValues (&cloud.points[i], field);
+        v_lo = _mm_min_ps (v, v_lo);
+        v_hi = _mm_max_ps (v, v_hi);
+      }
+      float los[4], his[4];
+      _mm_storeu_ps (los, v_lo);
+      _mm_storeu_ps (his, v_hi);
+      for (int k = 0; k < 4; ++k)
+      {
+        chunk_lo = std::min (chunk_lo, los[k]);
+        chunk_hi = std::max (chunk_hi, his[k]);
+      }
+    }
+#endif
+    for (; i < end; ++i)
+    {
+      if (!cloud.is_dense && !pcl::isFinite (cloud.points[i]))
+        continue;
+      float v = getFieldValue (cloud.points[i], field);
+      if (pcl_isfinite (v))
+      {
+        chunk_lo = std::min (chunk_lo, v);
+        chunk_hi = std::max (chunk_hi, v);
+      }
+    }
+#pragma omp critical
+    {
+      lo = std::min (lo, chunk_lo);
+      hi = std::max (hi, chunk_hi);
+    }
+  }
+  return (lo <= hi);
+}
+
+template <typename PointT> FieldRange
+getFieldRange (const pcl::PointCloud<PointT>& cloud, ColourField field)
+{
+  FieldRange range;
+  if (!computeFieldRange (cloud, field, range.lo, range.hi))
+    range.lo = range.hi = 0.0f;
+  range.known = true;
+  return (range);
+}
+
+// For a cloud known only by its bounds, as a paged one is: z over the box,
+// range from the nearest to the farthest point of the box
+inline FieldRange
+getBoxFieldRange (const float* min_pt, const float* max_pt, ColourField field)
+{
+  FieldRange range;
+  range.known = true;
+  if (field == COLOUR_FIELD_Z)
+  {
+    range.lo = min_pt[2];
+    range.hi = max_pt[2];
+  }
+  else if (field == COLOUR_FIELD_RANGE)
+  {
+    float near_sq = 0.0f, far_sq = 0.0f;
+    for (int k = 0; k < 3; ++k)
+    {
+      float nearest = std::max (min_pt[k], std::min (0.0f, max_pt[k]));
+      float farthest = std::max (std::fabs (min_pt[k]), std::fabs (max_pt[k]));
+      near_sq += nearest * nearest;
+      far_sq += farthest * farthest;
+    }
+    range.lo = std::sqrt (near_sq);
+    range.hi = std::sqrt (far_sq);
+  }
+  return (range);
+}
+
+
+
+// Colours a cloud by one of its fields over range, blue to red; values
+// outside it take the colour at its nearer end. The colours are
+// written straight into the array VTK uploads, a thread per chunk.
+template <typename PointT>
+class PointCloudColorHandlerField : public pcl::visualization::PointCloudColorHandler<PointT>
+{
+  typedef pcl::visualization::PointCloudColorHandler<PointT> Base;
+  using Base::cloud_;
+  using Base::capable_;
+
+  public:
+    typedef typename Base::PointCloudConstPtr PointCloudConstPtr;
+
+    PointCloudColorHandlerField (const PointCloudConstPtr& cloud, ColourField field, const FieldRange& range) :
+      Base (cloud), field_ (field), lo_ (range.lo), hi_ (range.hi)
+    {
+      capable_ = (field != COLOUR_FIELD_NONE && (field != COLOUR_FIELD_INTENSITY || HasIntensity<PointT>::value));
+      for (int i = 0; i < COLOUR_TABLE_SIZE; ++i)
+        getRampColour (4.0f * i / (COLOUR_TABLE_SIZE - 1), table_[i]);
+    }
+
+    std::string
+    getName () const
+    {
+      return ("PointCloudColorHandlerField");
+    }
+
+    std::string
+    getFieldName () const
+    {
+      return (getColourFieldName (field_));
+    }
+
+    // Colours the points the XYZ geometry handler keeps: all of a dense
+    // cloud, the finite ones otherwise
+    bool
+    getColor (vtkSmartPointer<vtkDataArray>& scalars) const
+    {
+      if (!capable_ || !cloud_)
+        return (false);
+      if (!scalars)
+        scalars = vtkSmartPointer<vtkUnsignedCharArray>::New ();
+      vtkUnsignedCharArray* colours = reinterpret_cast<vtkUnsignedCharArray*> (&(*scalars));
+      colours->SetNumberOfComponents (3);
+      const int n = static_cast<int> (cloud_->points.size ());
+      vtkIdType kept = n;
+      if (!cloud_->is_dense)
+      {
+        kept = 0;
+        for (int i = 0; i < n; ++i)
+          kept += pcl::isFinite (cloud_->points[i]);
+      }
+      colours->SetNumberOfTuples (kept);
+      if (kept == 0)
+        return (true);
+      unsigned char* rgb = colours->GetPointer (0);
+      const float scale = (hi_ > lo_ ? (COLOUR_TABLE_SIZE - 1) / (hi_ - lo_) : 0.0f);
+
+      if (!cloud_->is_dense)
+      {
+        vtkIdType j = 0;
+        for (int i = 0; i < n; ++i)
+          if (pcl::isFinite (cloud_->points[i]))
+            setColour (getIndex (getFieldValue (cloud_->points[i], field_), scale), &rgb[3 * j++]);
+      }
+      else
+      {
+        const int chunks = getNumberOfThreads ();
+#pragma omp parallel for
+        for (int c = 0; c < chunks; ++c)
+        {
+          const int begin = static_cast<int> (static_cast<long long> (n) * c / chunks);
+          const int end = static_cast<int> (static_cast<long long> (n) * (c + 1) / chunks);
+          int i = begin;
+#if defined(PCL_VISUALIZER_HAS_SSE2)
+          // Scale, clamp and truncate four values at once; max before min
+          // sends NaN to the first entry, as getIndex does
+          const __m128 lo = _mm_set1_ps (lo_), factor = _mm_set1_ps (scale);
+          const __m128 zero = _mm_setzero_ps (), top = _mm_set1_ps (static_cast<float> (COLOUR_TABLE_SIZE - 1));
+          const __m128 half = _mm_set1_ps (0.5f);
+          int index[4];
+          for (; i + 4 <= end; i += 4)
+          {
+            __m128 t = _mm_add_ps (_mm_mul_ps (_mm_sub_ps (getFieldValues (&cloud_->points[i], field_), lo), factor), half);
+            t = _mm_min_ps (_mm_max_ps (t, zero), top);
+            _mm_storeu_si128 (reinterpret_cast<__m128i*> (index), _mm_cvttps_epi32 (t));
+            for (int k = 0; k < 4; ++k)
+              setColour (index[k], &rgb[3 * (i + k)]);
+          }
+#endif
+          for (; i < end; ++i)
+            setColour (getIndex (getFieldValue (cloud_->points[i], field_), scale), &rgb[3 * i]);
+        }
+      }
+      return (true);
+    }
+
+  private:
+    int
+    getIndex (float v, float scale) const
+    {
+      float t = (v - lo_) * scale + 0.5f;
+      if (!(t > 0.0f))
+        return (0);
+      return (static_cast<int> (std::min (static_cast<float> (COLOUR_TABLE_SIZE - 1), t)));
+    }
+
+    void
+    setColour (int index, unsigned char* rgb) const
+    {
+      rgb[0] = table_[index][0];
+      rgb[1] = table_[index][1];
+      rgb[2] = table_[index][2];
+    }
+
+    ColourField field_;
+    float lo_, hi_;
+    unsigned char table_[COLOUR_TABLE_SIZE][3];
+};
+
+#endif  // PCL_VISUALIZER_FIELD_COLOUR_H_
@@ -0,0 +1,236 @@
+/* --pipeline: crop, pass-through, voxel and outlier filters applied in order    */
+/* to the loaded cloud, each one working on the previous one's buffer            */
+
+#ifndef PCL_VISUALIZER_FILTER_PIPELINE_H_
+#define PCL_VISUALIZER_FILTER_PIPELINE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/console/time.h>
+#include <pcl/search/kdtree.h>
+
+#include "bench.h"
+#include "hash_voxel_grid.h"
+
+struct FilterStage
+{
+  std::string name;           // crop, pass, voxel or sor
+  std::vector<double> args;
+  int axis;                   // 0, 1 or 2 for pass
+};
+
+// "crop:x0,y0,z0,x1,y1,z1,voxel:0.05,sor:50,1.0,pass:z,0,10": a word with a
+// colon starts a stage and the values after it are its arguments
+inline bool
+parseFilterPipeline (const std::string& spec, std::vector<FilterStage>& stages)
+{
+  stages.clear ();
+  size_t begin = 0;
+  while (begin <= spec.size ())
+  {
+    size_t end = spec.find (',', begin);
+    if (end == std::string::npos)
+      end = spec.size ();
+    std::string word = spec.substr (begin, end - begin);
+    begin = end + 1;
+
+    size_t colon = word.find (':');
+    if (colon != std::string::npos)
+    {
+      stages.push_back (FilterStage ());
+      stages.back ().name = word.substr (0, colon);
+      stages.back ().axis = -1;
+      word = word.substr (colon + 1);
+    }
+    if (stages.empty ())
+    {
+      std::cerr << "--pipeline must start with a stage name, e.g. voxel:0.05" << std::endl;
+      return (false);
+    }
+    FilterStage& stage = stages.back ();
+    if (stage.name == "pass" && stage.axis < 0)
+    {
+      stage.axis = (word == "x" ? 0 : word == "y" ? 1 : word == "z" ? 2 : -1);
+      if (stage.axis < 0)
+      {
+        std::cerr << "pass filters on x, y or z, not \"" << word << "\"" << std::endl;
+        return (false);
+      }
+      continue;
+    }
+    char* parsed;
+    double value = std::strtod (word.c_str (), &parsed);
+    if (word.empty () || *parsed)
+    {
+      std::cerr << "Bad value \"" << word << "\" for " << stage.name << " in --pipeline" << std::endl;
+      return (false);
+    }
+    stage.args.push_back (value);
+  }
+
+  for (size_t i = 0; i < stages.size (); ++i)
+  {
+    const FilterStage& stage = stages[i];
+    size_t expected = (stage.name == "crop" ? 6 : stage.name == "pass" ? 2 : stage.name == "voxel" ? 1 :
+                       stage.name == "sor" ? 2 : 0);
+    if (!expected)
+    {
+      std::cerr << "Unknown --pipeline stage \"" << stage.name << "\"; use crop, pass, voxel or sor" << std::endl;
+      return (false);
+    }
+    if (stage.args.size () != expected)
+    {
+      std::cerr << stage.name << " takes " << expected << " values in --pipeline" << std::endl;
+      return (false);
+    }
+    if ((stage.name == "voxel" || stage.name == "sor") && !(stage.args[0] > 0))
+    {
+      std::cerr << stage.name << " needs a positive " << (stage.name == "voxel" ? "leaf size" : "neighbour count")
+                << " in --pipeline" << std::endl;
+      return (false);
+    }
+  }
+  return (true);
+}
+
+// Moves the kept points to the front, in order, and drops the rest. The
+// decisions are made in parallel; this pass is a single sequential sweep.
+template <typename PointT> void
+compactCloud (pcl::PointCloud<PointT>& cloud, const std::vector<char>& keep)
+{
+  size_t kept = 0;
+  for (size_t i = 0; i < cloud.points.size (); ++i)
+    if (keep[i])
+    {
+      if (kept != i)
+        cloud.points[kept] = cloud.points[i];
+      ++kept;
+    }
+  cloud.points.resize (kept);
+  cloud.width = static_cast<uint32_t> (kept);
+  cloud.height = 1;
+}
+
+// Keeps the points with min <= p[axis] <= max on every axis given; NaN
+// points fail every comparison and are dropped
+template <typename PointT> void
+boxFilter (pcl::PointCloud<PointT>& cloud, const float min[3], const float max[3], const bool use[3])
+{
+  const int n = static_cast<int> (cloud.points.size ());
+  std::vector<char> keep (n);
+#pragma omp parallel for
+  for (int i = 0; i < n; ++i)
+  {
+    const PointT& p = cloud.points[i];
+    bool inside = true;
+    for (int axis = 0; axis < 3; ++axis)
+      if (use[axis] && !(p.data[axis] >= min[axis] && p.data[axis] <= max[axis]))
+        inside = false;
+    keep[i] = inside;
+  }
+  compactCloud (cloud, keep);
+  cloud.is_dense = true;
+}
+
+// Same rule as pcl::StatisticalOutlierRemoval: a point whose mean distance
+// to its k neighbours is more than mul standard deviations above the mean
+// of those distances is dropped. In a cloud of k points or fewer the mean
+// is over the neighbours there are; a point with none at all is kept, as
+// there is nothing to judge it by. Non-finite points are dropped. The
+// searches run in parallel.
+template <typename PointT> void
+statisticalOutlierFilter (const typename pcl::PointCloud<PointT>::Ptr& cloud, int k, double mul)
+{
+  const int n = static_cast<int> (cloud->points.size ());
+  typename pcl::search::KdTree<PointT>::Ptr tree (new pcl::search::KdTree<PointT> (false));
+  tree->setInputCloud (cloud);
+  std::vector<float> mean_distance (n);
+  std::vector<char> keep (n), measured (n);
+  double sum = 0.0, sum_sq = 0.0;
+  int valid = 0;
+#pragma omp parallel
+  {
+    std::vector<int> indices (k + 1);
+    std::vector<float> sqr_distances (k + 1);
+#pragma omp for reduction (+:sum, sum_sq, valid)
+    for (int i = 0; i < n; ++i)
+    {
+      keep[i] = pcl::isFinite (cloud->points[i]);
+      measured[i] = false;
+      if (!keep[i])
+        continue;
+      // The first neighbour found is the point itself
+      int found = tree->nearestKSearch (i, k + 1, indices, sqr_distances);
+      if (found < 2)
+        continue;
+      double d = 0.0;
+      for (int j = 1; j < found; ++j)
+        d += std::sqrt (sqr_distances[j]);
+      mean_distance[i] = static_cast<float> (d / (found - 1));
+      measured[i] = true;
+      sum += mean_distance[i];
+      sum_sq += mean_distance[i] * mean_distance[i];
+      ++valid;
+    }
+  }
+  if (valid > 1)
+  {
+    double mean = sum / valid;
+    double stddev = std::sqrt (std::max (0.0, (sum_sq - sum * mean) / (valid - 1)));
+    float threshold = static_cast<float> (mean + mul * stddev);
+#pragma omp parallel for
+    for (int i = 0; i < n; ++i)
+      if (measured[i] && mean_distance[i] > threshold)
+        keep[i] = false;
+  }
+  compactCloud (*cloud, keep);
+  cloud->is_dense = true;
+}
+
+// -----------------------------------------------
+// -----Run the stages on the cloud, in place-----
+// -----------------------------------------------
+// Returns false, with the stages run so far applied, if a stage cannot run
+template <typename PointT> bool
+runFilterPipeline (const std::vector<FilterStage>& stages, const typename pcl::PointCloud<PointT>::Ptr& cloud,
+                   BenchReport& report)
+{
+  pcl::console::TicToc tt;
+  for (size_t i = 0; i < stages.size (); ++i)
+  {
+    const FilterStage& stage = stages[i];
+    const std::vector<double>& a = stage.args;
+    size_t before = cloud->points.size ();
+    tt.tic ();
+    if (stage.name == "crop" || stage.name == "pass")
+    {
+      float min[3], max[3];
+      bool use[3];
+      for (int axis = 0; axis < 3; ++axis)
+      {
+        use[axis] = (stage.name == "crop" || axis == stage.axis);
+        min[axis] = static_cast<float> (stage.name == "crop" ? a[axis] : a[0]);
+        max[axis] = static_cast<float> (stage.name == "crop" ? a[axis + 3] : a[1]);
+      }
+      boxFilter (*cloud, min, max, use);
+    }
+    else if (stage.name == "voxel" && !hashVoxelFilter (*cloud, static_cast<float> (a[0])))
+      return (false);
+    else if (stage.name == "sor")
+      statisticalOutlierFilter<PointT> (cloud, std::max (1, static_cast<int> (a[0])), a[1]);
+    double ms = tt.toc ();
+    std::cerr << "Filter " << stage.name << ": " << before << " -> " << cloud->points.size () << " points in "
+              << ms << " ms\n";
+    report.addStage ("filter_" + stage.name, ms, before, 0);
+  }
+  return (true);
+}
+
+#endif  // PCL_VISUALIZER_FILTER_PIPELINE_H_
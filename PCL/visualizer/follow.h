@@ -0,0 +1,194 @@
+/* Follows a text file that another process keeps appending points to            */
+/* Linux is told about writes by inotify; elsewhere the file size is polled      */
+
+#ifndef PCL_VISUALIZER_FOLLOW_H_
+#define PCL_VISUALIZER_FOLLOW_H_
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "xyz_loader.h"
+
+class FileFollower
+{
+  public:
+    FileFollower (const std::string& filename) :
+      filename_ (filename), offset_ (0), fd_ (-1), changed_ (true), stop_ (false)
+    {
+#if defined(__linux__)
+      fd_ = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+      if (fd_ >= 0 && inotify_add_watch (fd_, filename.c_str (), IN_MODIFY | IN_CLOSE_WRITE) < 0)
+      {
+        close (fd_);
+        fd_ = -1;
+      }
+#endif
+    }
+
+    ~FileFollower ()
+    {
+      stopWatching ();
+#if defined(__linux__)
+      if (fd_ >= 0)
+        close (fd_);
+#endif
+    }
+
+    // True if writes are reported; otherwise poll has to be called on a timer
+    bool
+    isWatched () const
+    {
+      return (fd_ >= 0);
+    }
+
+    // Waits for writes on a thread of its own, which only marks the file
+    // changed; isPending tells the caller's thread when to poll
+    void
+    startWatching ()
+    {
+      if (fd_ >= 0 && !watcher_.joinable ())
+        watcher_ = boost::thread (&FileFollower::watch, this);
+    }
+
+    // True if poll may find something new; does not take the news away
+    bool
+    isPending ()
+    {
+      if (fd_ < 0)
+        return (true);
+      boost::mutex::scoped_lock lock (mutex_);
+      return (changed_);
+    }
+
+    void
+    stopWatching ()
+    {
+      {
+        boost::mutex::scoped_lock lock (mutex_);
+        stop_ = true;
+      }
+      if (watcher_.joinable ())
+        watcher_.join ();
+    }
+
+    // Appends the points of the lines completed since the last call to
+    // cloud. A line still being written is left for the next call. Returns
+    // false if nothing was added. Sets truncated (and starts over from the
+    // beginning) if the file got shorter than what was already read.
+    bool
+    poll (pcl::PointCloud<pcl::PointXYZ>& cloud, bool& truncated)
+    {
+      truncated = false;
+      if (!hasChanged ())
+        return (false);
+
+      boost::system::error_code ec;
+      uintmax_t size = boost::filesystem::file_size (filename_, ec);
+      if (ec)
+        return (false);
+      if (size < offset_)
+      {
+        std::cout << filename_ << " was truncated, following it from the start\n";
+        offset_ = 0;
+        carry_.clear ();
+        truncated = true;
+      }
+      if (size == offset_)
+        return (false);
+
+      std::ifstream in (filename_.c_str (), std::ios::binary);
+      in.seekg (static_cast<std::streamoff> (offset_));
+      size_t carried = carry_.size ();
+      buffer_.swap (carry_);
+      buffer_.resize (carried + static_cast<size_t> (size - offset_));
+      in.read (&buffer_[carried], static_cast<std::streamsize> (size - offset_));
+      buffer_.resize (carried + static_cast<size_t> (in.gcount ()));
+      offset_ += static_cast<uintmax_t> (in.gcount ());
+
+      size_t cut = buffer_.size ();
+      while (cut > 0 && buffer_[cut - 1] != '\n')
+        --cut;
+      carry_.assign (buffer_.begin () + cut, buffer_.end ());
+      if (cut == 0)
+        return (false);
+
+      size_t before = cloud.points.size ();
+      size_t consumed = parseXYZBuffer (&buffer_[0], &buffer_[0] + cut, cloud);
+      if (consumed < cut)
+        std::cerr << "Skipped the rest of an update to " << filename_ << " after a malformed line" << std::endl;
+      return (cloud.points.size () > before);
+    }
+
+  private:
+    // inotify reports writes, drained here or by the watcher thread;
+    // without it every call looks at the file
+    bool
+    hasChanged ()
+    {
+      if (fd_ < 0)
+        return (true);
+      boost::mutex::scoped_lock lock (mutex_);
+      bool changed = drainEvents () || changed_;
+      changed_ = false;
+      return (changed);
+    }
+
+    // Called with mutex_ held
+    bool
+    drainEvents ()
+    {
+      bool drained = false;
+#if defined(__linux__)
+      char events[4096];
+      while (read (fd_, events, sizeof (events)) > 0)
+        drained = true;
+#endif
+      return (drained);
+    }
+
+    // Sleeps on the inotify descriptor, waking now and then to see if it
+    // should stop
+    void
+    watch ()
+    {
+#if defined(__linux__)
+      struct pollfd readable;
+      readable.fd = fd_;
+      readable.events = POLLIN;
+      for (;;)
+      {
+        readable.revents = 0;
+        int ready = ::poll (&readable, 1, 250);
+        boost::mutex::scoped_lock lock (mutex_);
+        if (stop_)
+          return;
+        if (ready > 0 && drainEvents ())
+          changed_ = true;
+      }
+#endif
+    }
+
+    std::string filename_;
+    uintmax_t offset_;
+    int fd_;
+    bool changed_, stop_;       // under mutex_ once the watcher runs
+    std::vector<char> buffer_, carry_;
+    boost::mutex mutex_;
+    boost::thread watcher_;
+};
+
+#endif  // PCL_VISUALIZER_FOLLOW_H_
@@ -0,0 +1,147 @@
+/* Several -f files loaded side by side for the grid of viewports, each on its   */
+/* share of the threads; files with the same bytes are loaded once               */
+
+#ifndef PCL_VISUALIZER_GRID_LOADER_H_
+#define PCL_VISUALIZER_GRID_LOADER_H_
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/console/time.h>
+
+#include "bench.h"
+#include "binary_loader.h"
+#include "cloud_cache.h"
+#include "filter_pipeline.h"
+#include "xyz_loader.h"
+
+inline bool
+haveSameContent (const std::string& a, const std::string& b)
+{
+  try
+  {
+    boost::iostreams::mapped_file_source first (a), second (b);
+    return (first.size () == second.size () && std::memcmp (first.data (), second.data (), first.size ()) == 0);
+  }
+  catch (const std::exception&)
+  {
+    return (false);
+  }
+}
+
+// For every file, the index of the first file with the same bytes (itself
+// if there is none). The cache key's size and sampled hash pick the
+// candidates; a full comparison decides.
+inline std::vector<size_t>
+findDuplicateFiles (const std::vector<std::string>& files)
+{
+  std::vector<CloudCacheKey> keys (files.size ());
+  std::vector<char> valid (files.size ());
+  std::vector<size_t> source (files.size ());
+  for (size_t i = 0; i < files.size (); ++i)
+  {
+    valid[i] = getCacheKey (files[i], keys[i]);
+    source[i] = i;
+    for (size_t j = 0; j < i && source[i] == i; ++j)
+      if (valid[i] && valid[j] && source[j] == j && keys[i].size == keys[j].size && keys[i].hash == keys[j].hash &&
+          (files[i] == files[j] || haveSameContent (files[i], files[j])))
+        source[i] = j;
+  }
+  return (source);
+}
+
+// Takes the next file off the list until there is none left
+template <typename PointT> void
+loadPointFilesWorker (const std::vector<std::string>& files, const std::vector<size_t>& unique, size_t& next,
+                      boost::mutex& mutex, int threads, bool use_cache, const std::vector<FilterStage>& filters,
+                      std::vector<typename pcl::PointCloud<PointT>::Ptr>& clouds, bool& failed)
+{
+#ifdef _OPENMP
+  omp_set_num_threads (threads);
+#endif
+  for (;;)
+  {
+    size_t index;
+    {
+      boost::mutex::scoped_lock lock (mutex);
+      if (next >= unique.size ())
+        return;
+      index = unique[next++];
+    }
+    typename pcl::PointCloud<PointT>::Ptr cloud (new pcl::PointCloud<PointT>);
+    if (!loadPointFile (files[index], *cloud, use_cache))
+    {
+      boost::mutex::scoped_lock lock (mutex);
+      failed = true;
+      continue;
+    }
+    BenchReport report;
+    if (!filters.empty () && !runFilterPipeline<PointT> (filters, cloud, report))
+    {
+      boost::mutex::scoped_lock lock (mutex);
+      failed = true;
+      continue;
+    }
+    clouds[index] = cloud;
+  }
+}
+
+
+// -------------------------------------------------
+// -----Load the files of the grid concurrently-----
+// -------------------------------------------------
+// Duplicates get the same cloud as the file they repeat, so they are kept
+// in memory, and drawn, once. Returns false if any file could not be read.
+template <typename PointT> bool
+loadPointFiles (const std::vector<std::string>& files, bool use_cache, const std::vector<FilterStage>& filters,
+                std::vector<typename pcl::PointCloud<PointT>::Ptr>& clouds)
+{
+  pcl::console::TicToc tt;
+  tt.tic ();
+  std::vector<size_t> source = findDuplicateFiles (files);
+  std::vector<size_t> unique;
+  for (size_t i = 0; i < files.size (); ++i)
+    if (source[i] == i)
+      unique.push_back (i);
+
+  // As many files at once as there are threads, and the threads left over
+  // shared among them
+  const int total_threads = getNumberOfThreads ();
+  const int workers = std::max (1, std::min (total_threads, static_cast<int> (unique.size ())));
+  const int threads = std::max (1, total_threads / workers);
+  clouds.assign (files.size (), typename pcl::PointCloud<PointT>::Ptr ());
+  size_t next = 0;
+  boost::mutex mutex;
+  bool failed = false;
+  boost::thread_group pool;
+  for (int i = 0; i < workers; ++i)
+    pool.create_thread (boost::bind (&loadPointFilesWorker<PointT>, boost::cref (files), boost::cref (unique),
+                                     boost::ref (next), boost::ref (mutex), threads, use_cache, boost::cref (filters),
+                                     boost::ref (clouds), boost::ref (failed)));
+  pool.join_all ();
+  if (failed)
+    return (false);
+
+  size_t points = 0;
+  for (size_t i = 0; i < files.size (); ++i)
+  {
+    if (source[i] != i)
+      clouds[i] = clouds[source[i]];
+    else
+      points += clouds[i]->points.size ();
+  }
+  std::cout << "Loaded " << files.size () << " files (" << unique.size () << " distinct, " << points << " points) in "
+            << tt.toc () << " ms on " << workers << " workers\n";
+  return (true);
+}
+
+#endif  // PCL_VISUALIZER_GRID_LOADER_H_
@@ -0,0 +1,303 @@
+/* Voxel-grid downsampling with hash tables instead of a sort: every thread     */
+/* accumulates its share of the points, then each merges one shard of voxels     */
+
+#ifndef PCL_VISUALIZER_HASH_VOXEL_GRID_H_
+#define PCL_VISUALIZER_HASH_VOXEL_GRID_H_
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/common/common.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PCL_VISUALIZER_HAS_SSE2
+#endif
+
+#include "xyz_loader.h"
+
+// Voxel coordinates get 21 bits each, so a key fits in 63 bits and the all
+// ones value can mark an empty slot
+static const int VOXEL_KEY_BITS = 21;
+static const boost::uint64_t VOXEL_EMPTY_KEY = ~static_cast<boost::uint64_t> (0);
+
+// Running sums of one voxel. Positions, and the intensity or colour in
+// extra, are summed in double so averages of crowded voxels do not lose
+// precision.
+struct VoxelCell
+{
+  boost::uint64_t key;
+  boost::uint32_t count;
+  double extra[3];
+  double sum[3];
+};
+
+inline void
+addExtraFields (const pcl::PointXYZ&, double*)
+{
+}
+
+inline void
+addExtraFields (const pcl::PointXYZI& p, double* extra)
+{
+  extra[0] += p.intensity;
+}
+
+inline void
+addExtraFields (const pcl::PointXYZRGB& p, double* extra)
+{
+  extra[0] += p.r;
+  extra[1] += p.g;
+  extra[2] += p.b;
+}
+
+inline void
+setExtraFields (pcl::PointXYZ&, const double*, double)
+{
+}
+
+inline void
+setExtraFields (pcl::PointXYZI& p, const double* extra, double inv_count)
+{
+  p.intensity = static_cast<float> (extra[0] * inv_count);
+}
+
+inline void
+setExtraFields (pcl::PointXYZRGB& p, const double* extra, double inv_count)
+{
+  p.r = static_cast<boost::uint8_t> (extra[0] * inv_count + 0.5);
+  p.g = static_cast<boost::uint8_t> (extra[1] * inv_count + 0.5);
+  p.b = static_cast<boost::uint8_t> (extra[2] * inv_count + 0.5);
+  p.a = 255;
+}
+
+// Finaliser of MurmurHash3: voxel keys of neighbours differ in few bits
+inline boost::uint64_t
+hashVoxelKey (boost::uint64_t key)
+{
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ULL;
+  key ^= key >> 33;
+  return (key);
+}
+
+
+// Open addressing with linear probing, grown at half full
+class VoxelTable
+{
+  public:
+    VoxelTable () : size_ (0), mask_ (0) {}
+
+    size_t
+    size () const
+    {
+      return (size_);
+    }
+
+    const std::vector<VoxelCell>&
+    getCells () const
+    {
+      return (cells_);
+    }
+
+    // The cell of key, zeroed if it is new
+    VoxelCell&
+    find (boost::uint64_t key, boost::uint64_t hash)
+    {
+      if (2 * (size_ + 1) > cells_.size ())
+        grow ();
+      size_t slot = static_cast<size_t> (hash >> 20) & mask_;
+      while (cells_[slot].key != key)
+      {
+        if (cells_[slot].key == VOXEL_EMPTY_KEY)
+        {
+          VoxelCell& cell = cells_[slot];
+          cell.key = key;
+          cell.count = 0;
+          cell.extra[0] = cell.extra[1] = cell.extra[2] = 0.0;
+          cell.sum[0] = cell.sum[1] = cell.sum[2] = 0.0;
+          ++size_;
+          return (cell);
+        }
+        slot = (slot + 1) & mask_;
+      }
+      return (cells_[slot]);
+    }
+
+    void
+    merge (const VoxelCell& other)
+    {
+      VoxelCell& cell = find (other.key, hashVoxelKey (other.key));
+      cell.count += other.count;
+      for (int i = 0; i < 3; ++i)
+      {
+        cell.extra[i] += other.extra[i];
+        cell.sum[i] += other.sum[i];
+      }
+    }
+
+  private:
+    void
+    grow ()
+    {
+      std::vector<VoxelCell> old;
+      old.swap (cells_);
+      VoxelCell empty;
+      empty.key = VOXEL_EMPTY_KEY;
+      cells_.assign (std::max<size_t> (64, old.size () * 2), empty);
+      mask_ = cells_.size () - 1;
+      size_ = 0;
+      for (size_t i = 0; i < old.size (); ++i)
+        if (old[i].key != VOXEL_EMPTY_KEY)
+          find (old[i].key, hashVoxelKey (old[i].key)) = old[i];
+    }
+
+    std::vector<VoxelCell> cells_;
+    size_t size_, mask_;
+};
+
+
+// ----------------------------------------------
+// -----Downsample to one centroid per voxel-----
+// ----------------------------------------------
+// The cloud is cut into one chunk per thread. Every chunk fills its own
+// tables, one per shard of the key space, with no locking; then every shard
+// is merged by one thread and written to its own range of the output.
+// Returns false, leaving the cloud alone, if the extent over the leaf size
+// needs more than 21 bits on an axis.
+template <typename PointT> bool
+hashVoxelFilter (pcl::PointCloud<PointT>& cloud, float leaf)
+{
+  const int n = static_cast<int> (cloud.points.size ());
+  const int threads = getNumberOfThreads ();
+  const int shards = threads;
+
+  // Bounds of the finite points, merged from per-chunk bounds
+  Eigen::Array4f min_pt = Eigen::Array4f::Constant (std::numeric_limits<float>::max ());
+  Eigen::Array4f max_pt = Eigen::Array4f::Constant (-std::numeric_limits<float>::max ());
+#pragma omp parallel for
+  for (int c = 0; c < threads; ++c)
+  {
+    Eigen::Array4f lo = Eigen::Array4f::Constant (std::numeric_limits<float>::max ());
+    Eigen::Array4f hi = Eigen::Array4f::Constant (-std::numeric_limits<float>::max ());
+    int begin = static_cast<int> (static_cast<long long> (n) * c / threads);
+    int end = static_cast<int> (static_cast<long long> (n) * (c + 1) / threads);
+    for (int i = begin; i < end; ++i)
+    {
+      const PointT& p = cloud.points[i];
+      if (!pcl_isfinite (p.x) || !pcl_isfinite (p.y) || !pcl_isfinite (p.z))
+        continue;
+      Eigen::Array4f v (p.x, p.y, p.z, 0.0f);
+      lo = lo.min (v);
+      hi = hi.max (v);
+    }
+#pragma omp critical
+    {
+      min_pt = min_pt.min (lo);
+      max_pt = max_pt.max (hi);
+    }
+  }
+  if (!(min_pt[0] <= max_pt[0]))
+    return (true);        // nothing finite to keep or drop
+  const float inv_leaf = 1.0f / leaf;
+  const double limit = static_cast<double> (1 << VOXEL_KEY_BITS);
+  for (int axis = 0; axis < 3; ++axis)
+    if ((static_cast<double> (max_pt[axis]) - min_pt[axis]) / leaf >= limit - 1)
+    {
+      std::cerr << "Voxel leaf " << leaf << " is too small for this cloud: more than " << (1 << VOXEL_KEY_BITS)
+                << " voxels along an axis" << std::endl;
+      return (false);
+    }
+
+  // Accumulate: tables[c * shards + s] holds chunk c's voxels of shard s
+  std::vector<VoxelTable> tables (static_cast<size_t> (threads) * shards);
+#pragma omp parallel for
+  for (int c = 0; c < threads; ++c)
+  {
+    VoxelTable* mine = &tables[static_cast<size_t> (c) * shards];
+    int begin = static_cast<int> (static_cast<long long> (n) * c / threads);
+    int end = static_cast<int> (static_cast<long long> (n) * (c + 1) / threads);
+#if defined(PCL_VISUALIZER_HAS_SSE2)
+    const __m128 origin = _mm_set_ps (0.0f, min_pt[2], min_pt[1], min_pt[0]);
+    const __m128 scale = _mm_set1_ps (inv_leaf);
+#endif
+    for (int i = begin; i < end; ++i)
+    {
+      const PointT& p = cloud.points[i];
+      if (!pcl_isfinite (p.x) || !pcl_isfinite (p.y) || !pcl_isfinite (p.z))
+        continue;
+      // Offsets from the minimum are never negative, so truncation floors
+#if defined(PCL_VISUALIZER_HAS_SSE2)
+      boost::int32_t index[4];
+      _mm_storeu_si128 (reinterpret_cast<__m128i*> (index),
+                        _mm_cvttps_epi32 (_mm_mul_ps (_mm_sub_ps (_mm_loadu_ps (p.data), origin), scale)));
+#else
+      boost::int32_t index[3];
+      for (int axis = 0; axis < 3; ++axis)
+        index[axis] = static_cast<boost::int32_t> ((p.data[axis] - min_pt[axis]) * inv_leaf);
+#endif
+      boost::uint64_t key = (static_cast<boost::uint64_t> (index[2]) << (2 * VOXEL_KEY_BITS)) |
+                            (static_cast<boost::uint64_t> (index[1]) << VOXEL_KEY_BITS) |
+                            static_cast<boost::uint64_t> (index[0]);
+      boost::uint64_t hash = hashVoxelKey (key);
+      VoxelCell& cell = mine[hash % shards].find (key, hash);
+      ++cell.count;
+      cell.sum[0] += p.x;
+      cell.sum[1] += p.y;
+      cell.sum[2] += p.z;
+      addExtraFields (p, cell.extra);
+    }
+  }
+
+  // Merge every chunk's part of a shard into the first chunk's table
+#pragma omp parallel for
+  for (int s = 0; s < shards; ++s)
+    for (int c = 1; c < threads; ++c)
+    {
+      VoxelTable& other = tables[static_cast<size_t> (c) * shards + s];
+      const std::vector<VoxelCell>& cells = other.getCells ();
+      for (size_t i = 0; i < cells.size (); ++i)
+        if (cells[i].key != VOXEL_EMPTY_KEY)
+          tables[s].merge (cells[i]);
+      other = VoxelTable ();
+    }
+
+  std::vector<size_t> offsets (shards + 1, 0);
+  for (int s = 0; s < shards; ++s)
+    offsets[s + 1] = offsets[s] + tables[s].size ();
+  pcl::PointCloud<PointT> filtered;
+  filtered.points.resize (offsets[shards]);
+#pragma omp parallel for
+  for (int s = 0; s < shards; ++s)
+  {
+    const std::vector<VoxelCell>& cells = tables[s].getCells ();
+    size_t out = offsets[s];
+    for (size_t i = 0; i < cells.size (); ++i)
+    {
+      const VoxelCell& cell = cells[i];
+      if (cell.key == VOXEL_EMPTY_KEY)
+        continue;
+      PointT& p = filtered.points[out++];
+      double inv_count = 1.0 / cell.count;
+      p.x = static_cast<float> (cell.sum[0] * inv_count);
+      p.y = static_cast<float> (cell.sum[1] * inv_count);
+      p.z = static_cast<float> (cell.sum[2] * inv_count);
+      setExtraFields (p, cell.extra, inv_count);
+    }
+  }
+  filtered.width = static_cast<uint32_t> (filtered.points.size ());
+  filtered.height = 1;
+  filtered.is_dense = true;
+  cloud.swap (filtered);
+  return (true);
+}
+
+#endif  // PCL_VISUALIZER_HASH_VOXEL_GRID_H_
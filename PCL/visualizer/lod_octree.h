@@ -0,0 +1,534 @@
+/* Multi-resolution octree for drawing large clouds under a point budget         */
+/* Points inside each leaf are kept in random order, so any prefix of a leaf is  */
+/* a uniform subsample of it; far leaves contribute short prefixes, near leaves  */
+/* long ones                                                                     */
+
+#ifndef PCL_VISUALIZER_LOD_OCTREE_H_
+#define PCL_VISUALIZER_LOD_OCTREE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#include <stdint.h>
+
+#include <boost/shared_ptr.hpp>
+#include <Eigen/Core>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/console/time.h>
+#include <pcl/visualization/pcl_visualizer.h>
+
+#include "compact_cloud.h"
+
+struct LodNode
+{
+  float min_pt[3], max_pt[3];
+  size_t begin, end;          // slice of LodOctree::indices_
+  int children[8];            // -1 where the octant is empty
+  bool leaf;
+};
+
+// Number of points to draw from the start of a leaf
+struct LodSelection
+{
+  int node;
+  size_t count;
+};
+
+
+// ---------------------------------------------------------------
+// -----Share a point budget between boxes by projected size-----
+// ---------------------------------------------------------------
+// Each box gets min (points, lambda * (diagonal / distance)^2) points, i.e.
+// a constant number of points per unit of screen area, with lambda chosen
+// so the total matches the budget. Boxes outside the view cone get nothing.
+// lambda * area can pass what a size_t holds, so it is clamped as a double.
+// Used by both the in-memory octree and the paged out-of-core store.
+inline void
+distributeBudget (const std::vector<Eigen::Vector3f>& box_min, const std::vector<Eigen::Vector3f>& box_max,
+                  const std::vector<size_t>& points, const pcl::visualization::Camera& camera,
+                  size_t budget, std::vector<size_t>& counts)
+{
+  const size_t n = points.size ();
+  Eigen::Vector3f eye (camera.pos[0], camera.pos[1], camera.pos[2]);
+  Eigen::Vector3f dir = Eigen::Vector3f (camera.focal[0], camera.focal[1], camera.focal[2]) - eye;
+  if (dir.norm () > 0)
+    dir.normalize ();
+  double aspect = camera.window_size[1] > 0 ? camera.window_size[0] / camera.window_size[1] : 1.0;
+  double half_angle = std::atan (std::tan (camera.fovy * 0.5) * std::sqrt (1.0 + aspect * aspect));
+
+  std::vector<double> area (n, 0.0);
+  size_t visible = 0;
+  for (size_t i = 0; i < n; ++i)
+  {
+    Eigen::Vector3f center = (box_min[i] + box_max[i]) * 0.5f;
+    float radius = (box_max[i] - box_min[i]).norm () * 0.5f;
+    Eigen::Vector3f to_center = center - eye;
+    float dist = to_center.norm ();
+    if (dist > radius)
+    {
+      // Bounding sphere against the cone around the view direction
+      double angle = std::acos (std::max (-1.0f, std::min (1.0f, to_center.dot (dir) / dist)));
+      if (angle - std::asin (radius / dist) > half_angle)
+        continue;
+    }
+    double d = std::max (dist - radius, radius * 0.1f + 1e-6f);
+    area[i] = (2.0 * radius / d) * (2.0 * radius / d);
+    visible += points[i];
+  }
+
+  counts.assign (n, 0);
+  if (visible <= budget)
+  {
+    for (size_t i = 0; i < n; ++i)
+      counts[i] = area[i] > 0 ? points[i] : 0;
+    return;
+  }
+
+  double lo = 0.0, hi = 0.0;
+  for (size_t i = 0; i < n; ++i)
+    if (area[i] > 0)
+      hi = std::max (hi, points[i] / area[i]);
+  for (int iteration = 0; iteration < 50; ++iteration)
+  {
+    double lambda = 0.5 * (lo + hi);
+    size_t total = 0;
+    for (size_t i = 0; i < n; ++i)
+      total += static_cast<size_t> (std::min<double> (points[i], lambda * area[i]));
+    if (total > budget)
+      hi = lambda;
+    else
+      lo = lambda;
+  }
+  for (size_t i = 0; i < n; ++i)
+    counts[i] = static_cast<size_t> (std::min<double> (points[i], lo * area[i]));
+}
+
+
+class LodOctree
+{
+  public:
+    LodOctree (size_t max_leaf_points = 8192, int max_depth = 20)
+      : max_leaf_points_ (max_leaf_points), max_depth_ (max_depth), dense_ (true) {}
+
+    // Builds the node hierarchy over an index permutation of cloud; the cloud
+    // itself is not reordered
+    void
+    build (const pcl::PointCloud<pcl::PointXYZ>::ConstPtr& cloud)
+    {
+      pcl::console::TicToc tt;
+      tt.tic ();
+      cloud_ = cloud;
+      dense_ = cloud->is_dense;
+      nodes_.clear ();
+      leaves_.clear ();
+      blocks_.clear ();
+      compact_ = CompactCloud ();
+      const size_t n = cloud->points.size ();
+      indices_.resize (n);
+      for (size_t i = 0; i < n; ++i)
+        indices_[i] = static_cast<uint32_t> (i);
+      if (n == 0)
+        return;
+
+      // Cubic root box around the cloud
+      float min_pt[3], max_pt[3];
+      computeBounds (0, n, min_pt, max_pt);
+      float size = std::max (max_pt[0] - min_pt[0], std::max (max_pt[1] - min_pt[1], max_pt[2] - min_pt[2]));
+      for (int k = 0; k < 3; ++k)
+        max_pt[k] = min_pt[k] + size;
+
+      // The top levels are split on one thread; the subtrees below them are
+      // independent and are built in parallel, then spliced in
+      const int parallel_depth = 2;
+      std::vector<int> deferred;
+      buildNode (0, n, min_pt, max_pt, 0, parallel_depth, nodes_, &deferred);
+
+      std::vector<std::vector<LodNode> > subtrees (deferred.size ());
+#pragma omp parallel for schedule(dynamic, 1)
+      for (int i = 0; i < static_cast<int> (deferred.size ()); ++i)
+      {
+        const LodNode& stub = nodes_[deferred[i]];
+        buildNode (stub.begin, stub.end, stub.min_pt, stub.max_pt, parallel_depth, max_depth_ + 1, subtrees[i], NULL);
+      }
+      for (size_t i = 0; i < deferred.size (); ++i)
+      {
+        int offset = static_cast<int> (nodes_.size ()) - 1;
+        for (size_t j = 0; j < subtrees[i].size (); ++j)
+          for (int c = 0; c < 8; ++c)
+            if (subtrees[i][j].children[c] >= 0)
+              subtrees[i][j].children[c] += offset;
+        nodes_[deferred[i]] = subtrees[i][0];
+        nodes_.insert (nodes_.end (), subtrees[i].begin () + 1, subtrees[i].end ());
+      }
+
+      for (size_t i = 0; i < nodes_.size (); ++i)
+        if (nodes_[i].leaf)
+          leaves_.push_back (static_cast<int> (i));
+
+      // Random order inside leaves makes every prefix a uniform subsample
+#pragma omp parallel for schedule(dynamic, 64)
+      for (int i = 0; i < static_cast<int> (leaves_.size ()); ++i)
+      {
+        const LodNode& leaf = nodes_[leaves_[i]];
+        uint32_t state = 2654435761u * static_cast<uint32_t> (i + 1);
+        for (size_t j = leaf.end - leaf.begin; j > 1; --j)
+        {
+          state ^= state << 13;
+          state ^= state >> 17;
+          state ^= state << 5;
+          std::swap (indices_[leaf.begin + j - 1], indices_[leaf.begin + state % j]);
+        }
+      }
+      std::cout << "Built LOD octree with " << nodes_.size () << " nodes (" << leaves_.size ()
+                << " leaves) over " << n << " points in " << tt.toc () << " ms\n";
+    }
+
+    // Chooses how much of each leaf to draw for the given camera
+    void
+    select (const pcl::visualization::Camera& camera, size_t budget, std::vector<LodSelection>& selection) const
+    {
+      std::vector<Eigen::Vector3f> box_min (leaves_.size ()), box_max (leaves_.size ());
+      std::vector<size_t> points (leaves_.size ()), counts;
+      for (size_t i = 0; i < leaves_.size (); ++i)
+      {
+        const LodNode& leaf = nodes_[leaves_[i]];
+        box_min[i] = Eigen::Vector3f (leaf.min_pt[0], leaf.min_pt[1], leaf.min_pt[2]);
+        box_max[i] = Eigen::Vector3f (leaf.max_pt[0], leaf.max_pt[1], leaf.max_pt[2]);
+        points[i] = leaf.end - leaf.begin;
+      }
+      distributeBudget (box_min, box_max, points, camera, budget, counts);
+
+      selection.clear ();
+      for (size_t i = 0; i < leaves_.size (); ++i)
+        if (counts[i] > 0)
+        {
+          LodSelection s;
+          s.node = leaves_[i];
+          s.count = counts[i];
+          selection.push_back (s);
+        }
+    }
+
+    // Replaces the cloud by one quantised block per leaf, in leaf order, with
+    // no coordinate off by more than precision, and lets go of the cloud and
+    // the index permutation. Returns false, keeping the cloud, if a leaf is
+    // too large for 21 bit steps at that precision.
+    bool
+    compact (float precision)
+    {
+      pcl::console::TicToc tt;
+      tt.tic ();
+      std::vector<std::pair<size_t, size_t> > ranges (leaves_.size ());
+      blocks_.assign (nodes_.size (), -1);
+      for (size_t i = 0; i < leaves_.size (); ++i)
+      {
+        ranges[i] = std::make_pair (nodes_[leaves_[i]].begin, nodes_[leaves_[i]].end);
+        blocks_[leaves_[i]] = static_cast<int> (i);
+      }
+      if (!cloud_ || !compact_.build (*cloud_, indices_, ranges, precision))
+      {
+        blocks_.clear ();
+        return (false);
+      }
+      std::cout << "Compacted " << compact_.size () << " points to " << compact_.getMemoryBytes () / (1024.0 * 1024.0)
+                << " MB (" << compact_.getMemoryBytes () / std::max<double> (1.0, static_cast<double> (compact_.size ()))
+                << " bytes per point; " << compact_.getBlockCount (COMPACT_SHORT_BITS) << " 16 bit and "
+                << compact_.getBlockCount (COMPACT_PACKED_BITS) << " 21 bit leaves) in " << tt.toc () << " ms\n";
+      cloud_.reset ();
+      std::vector<uint32_t> ().swap (indices_);
+      return (true);
+    }
+
+    bool
+    isCompact () const
+    {
+      return (!blocks_.empty ());
+    }
+
+    const CompactCloud&
+    getCompactCloud () const
+    {
+      return (compact_);
+    }
+
+    // Copies the selected points into out; compacted leaves are decoded
+    // straight into it
+    void
+    gather (const std::vector<LodSelection>& selection, pcl::PointCloud<pcl::PointXYZ>& out) const
+    {
+      std::vector<size_t> offsets (selection.size () + 1, 0);
+      for (size_t i = 0; i < selection.size (); ++i)
+        offsets[i + 1] = offsets[i] + selection[i].count;
+      out.points.resize (offsets.back ());
+#pragma omp parallel for schedule(dynamic, 16)
+      for (int i = 0; i < static_cast<int> (selection.size ()); ++i)
+      {
+        const LodNode& leaf = nodes_[selection[i].node];
+        if (isCompact ())
+          compact_.decode (blocks_[selection[i].node], selection[i].count, &out.points[offsets[i]]);
+        else
+          for (size_t j = 0; j < selection[i].count; ++j)
+            out.points[offsets[i] + j] = cloud_->points[indices_[leaf.begin + j]];
+      }
+      out.width = static_cast<uint32_t> (out.points.size ());
+      out.height = 1;
+      out.is_dense = (isCompact () || dense_);
+    }
+
+    const std::vector<LodNode>&
+    getNodes () const
+    {
+      return (nodes_);
+    }
+
+    const std::vector<int>&
+    getLeaves () const
+    {
+      return (leaves_);
+    }
+
+    const std::vector<uint32_t>&
+    getIndices () const
+    {
+      return (indices_);
+    }
+
+  private:
+    void
+    computeBounds (size_t begin, size_t end, float* min_pt, float* max_pt) const
+    {
+      for (int k = 0; k < 3; ++k)
+      {
+        min_pt[k] = std::numeric_limits<float>::max ();
+        max_pt[k] = -std::numeric_limits<float>::max ();
+      }
+      for (size_t i = begin; i < end; ++i)
+      {
+        const pcl::PointXYZ& p = cloud_->points[indices_[i]];
+        min_pt[0] = std::min (min_pt[0], p.x); max_pt[0] = std::max (max_pt[0], p.x);
+        min_pt[1] = std::min (min_pt[1], p.y); max_pt[1] = std::max (max_pt[1], p.y);
+        min_pt[2] = std::min (min_pt[2], p.z); max_pt[2] = std::max (max_pt[2], p.z);
+      }
+    }
+
+    // Moves the indices of [begin, end) whose coordinate k is below split to the front
+    size_t
+    partition (size_t begin, size_t end, int k, float split)
+    {
+      size_t i = begin, j = end;
+      while (i < j)
+      {
+        if (cloud_->points[indices_[i]].data[k] < split)
+          ++i;
+        else
+          std::swap (indices_[i], indices_[--j]);
+      }
+      return (i);
+    }
+
+    // Appends the subtree of [begin, end) to nodes and returns its index. At
+    // defer_depth a childless placeholder is made instead and recorded.
+    int
+    buildNode (size_t begin, size_t end, const float* min_pt, const float* max_pt, int depth, int defer_depth,
+               std::vector<LodNode>& nodes, std::vector<int>* deferred)
+    {
+      int index = static_cast<int> (nodes.size ());
+      LodNode node;
+      std::copy (min_pt, min_pt + 3, node.min_pt);
+      std::copy (max_pt, max_pt + 3, node.max_pt);
+      node.begin = begin;
+      node.end = end;
+      std::fill (node.children, node.children + 8, -1);
+      node.leaf = (end - begin <= max_leaf_points_ || depth >= max_depth_);
+      nodes.push_back (node);
+      if (node.leaf)
+        return (index);
+      if (deferred && depth == defer_depth)
+      {
+        deferred->push_back (index);
+        return (index);
+      }
+
+      // Split at the centre along x, then y, then z
+      float center[3];
+      for (int k = 0; k < 3; ++k)
+        center[k] = 0.5f * (min_pt[k] + max_pt[k]);
+      size_t bounds[9];
+      bounds[0] = begin;
+      bounds[8] = end;
+      bounds[4] = partition (begin, end, 0, center[0]);
+      bounds[2] = partition (bounds[0], bounds[4], 1, center[1]);
+      bounds[6] = partition (bounds[4], bounds[8], 1, center[1]);
+      for (int q = 0; q < 8; q += 2)
+        bounds[q + 1] = partition (bounds[q], bounds[q + 2], 2, center[2]);
+
+      for (int c = 0; c < 8; ++c)
+      {
+        if (bounds[c] == bounds[c + 1])
+          continue;
+        float child_min[3], child_max[3];
+        for (int k = 0; k < 3; ++k)
+        {
+          bool upper = (c >> (2 - k)) & 1;
+          child_min[k] = upper ? center[k] : min_pt[k];
+          child_max[k] = upper ? max_pt[k] : center[k];
+        }
+        int child = buildNode (bounds[c], bounds[c + 1], child_min, child_max, depth + 1, defer_depth, nodes, deferred);
+        nodes[index].children[c] = child;
+      }
+      return (index);
+    }
+
+    size_t max_leaf_points_;
+    int max_depth_;
+    pcl::PointCloud<pcl::PointXYZ>::ConstPtr cloud_;
+    std::vector<uint32_t> indices_;
+    std::vector<LodNode> nodes_;
+    std::vector<int> leaves_;
+    bool dense_;
+    CompactCloud compact_;
+    std::vector<int> blocks_;   // per node, its block of compact_; -1 for inner nodes
+};
+
+
+// ---------------------------------------------------
+// -----Tells when a moved camera has come to rest-----
+// ---------------------------------------------------
+class CameraWatch
+{
+  public:
+    CameraWatch () : moving_ (false) {}
+
+    // Remembers camera as the one the display was last selected for
+    void
+    reset (const pcl::visualization::Camera& camera)
+    {
+      selected_ = last_ = camera;
+      moving_ = false;
+    }
+
+    // Called once per frame; true once the camera has moved away from the
+    // last selection and then held still for a frame, so dragging does not
+    // trigger uploads
+    bool
+    settled (const pcl::visualization::Camera& camera)
+    {
+      bool still = sameCamera (camera, last_);
+      last_ = camera;
+      if (!still)
+      {
+        moving_ = true;
+        return (false);
+      }
+      bool settled = moving_ && !sameCamera (camera, selected_);
+      moving_ = false;
+      return (settled);
+    }
+
+    // True while a move has been seen that has not settled yet
+    bool
+    isMoving () const
+    {
+      return (moving_);
+    }
+
+    static bool
+    sameCamera (const pcl::visualization::Camera& a, const pcl::visualization::Camera& b)
+    {
+      for (int k = 0; k < 3; ++k)
+        if (a.pos[k] != b.pos[k] || a.focal[k] != b.focal[k] || a.view[k] != b.view[k])
+          return (false);
+      return (a.fovy == b.fovy && a.window_size[0] == b.window_size[0] && a.window_size[1] == b.window_size[1]);
+    }
+
+  private:
+    bool moving_;
+    pcl::visualization::Camera last_, selected_;
+};
+
+
+// ----------------------------------------------------------------------
+// -----Keeps a budget-sized subset of a cloud in step with the camera-----
+// ----------------------------------------------------------------------
+class BudgetRenderer
+{
+  public:
+    typedef boost::shared_ptr<BudgetRenderer> Ptr;
+
+    BudgetRenderer (size_t budget) : display_ (new pcl::PointCloud<pcl::PointXYZ>), budget_ (budget) {}
+
+    virtual ~BudgetRenderer () {}
+
+    pcl::PointCloud<pcl::PointXYZ>::Ptr
+    getDisplayCloud ()
+    {
+      return (display_);
+    }
+
+    // Reselects the displayed points for camera. Returns true if the display
+    // cloud changed and has to be uploaded again.
+    virtual bool
+    select (const pcl::visualization::Camera& camera) = 0;
+
+    bool
+    update (const pcl::visualization::Camera& camera)
+    {
+      return (watch_.settled (camera) && select (camera));
+    }
+
+    // True while the camera moved and update () still has to be called until
+    // it holds still
+    bool
+    isWaiting () const
+    {
+      return (watch_.isMoving ());
+    }
+
+  protected:
+    pcl::PointCloud<pcl::PointXYZ>::Ptr display_;
+    size_t budget_;
+    CameraWatch watch_;
+};
+
+
+class LodRenderer : public BudgetRenderer
+{
+  public:
+    LodRenderer (const pcl::PointCloud<pcl::PointXYZ>::ConstPtr& cloud, size_t budget) : BudgetRenderer (budget)
+    {
+      octree_.build (cloud);
+    }
+
+    const LodOctree&
+    getOctree () const
+    {
+      return (octree_);
+    }
+
+    bool
+    compact (float precision)
+    {
+      return (octree_.compact (precision));
+    }
+
+    // Runs on every camera-driven reselection, so it reports nothing; the
+    // perf HUD shows the points drawn
+    bool
+    select (const pcl::visualization::Camera& camera)
+    {
+      std::vector<LodSelection> selection;
+      octree_.select (camera, budget_, selection);
+      octree_.gather (selection, *display_);
+      watch_.reset (camera);
+      return (true);
+    }
+
+  private:
+    LodOctree octree_;
+};
+
+#endif  // PCL_VISUALIZER_LOD_OCTREE_H_
@@ -0,0 +1,193 @@
+/* Normal estimation on all cores over a search tree that is built only once     */
+
+#ifndef PCL_VISUALIZER_NORMALS_H_
+#define PCL_VISUALIZER_NORMALS_H_
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/console/time.h>
+#include <pcl/common/common.h>
+#include <pcl/features/normal_3d.h>
+#include <pcl/features/normal_3d_omp.h>
+#include <pcl/search/kdtree.h>
+
+#include "xyz_loader.h"
+
+// -------------------------------------------------------------------------
+// -----Build the KD-tree once; features that get it reuse it as is-----
+// -------------------------------------------------------------------------
+// pcl::Feature only rebuilds a search tree whose input is not the cloud it
+// works on, so passing this tree with the same cloud pointer skips the build.
+inline pcl::search::KdTree<pcl::PointXYZ>::Ptr
+buildSearchTree (const pcl::PointCloud<pcl::PointXYZ>::ConstPtr& cloud)
+{
+  pcl::console::TicToc tt;
+  tt.tic ();
+  pcl::search::KdTree<pcl::PointXYZ>::Ptr tree (new pcl::search::KdTree<pcl::PointXYZ>);
+  tree->setSortedResults (true);
+  tree->setInputCloud (cloud);
+  std::cout << "Built KD-tree over " << cloud->points.size () << " points in " << tt.toc () << " ms\n";
+  return (tree);
+}
+
+
+inline pcl::PointCloud<pcl::Normal>::Ptr
+estimateNormals (const pcl::PointCloud<pcl::PointXYZ>::ConstPtr& cloud,
+                 const pcl::search::KdTree<pcl::PointXYZ>::Ptr& tree, double radius)
+{
+  pcl::console::TicToc tt;
+  tt.tic ();
+  pcl::NormalEstimationOMP<pcl::PointXYZ, pcl::Normal> estimation (getNumberOfThreads ());
+  estimation.setInputCloud (cloud);
+  estimation.setSearchMethod (tree);
+  estimation.setRadiusSearch (radius);
+  pcl::PointCloud<pcl::Normal>::Ptr normals (new pcl::PointCloud<pcl::Normal>);
+  estimation.compute (*normals);
+
+  double ms = tt.toc ();
+  std::cout << "Estimated " << normals->points.size () << " normals at radius " << radius << " in " << ms << " ms: "
+            << cloud->points.size () / (ms * 0.001 + 1e-9) << " points/s on " << getNumberOfThreads () << " threads\n";
+  return (normals);
+}
+
+
+// Normal of the neighbours summed so far; sums are relative to the query point
+// so the covariance does not lose precision far from the origin
+inline void
+normalFromSums (const pcl::PointXYZ& point, size_t count, const double sums[9], pcl::Normal& normal)
+{
+  if (count < 3)
+  {
+    normal.normal_x = normal.normal_y = normal.normal_z = normal.curvature = std::numeric_limits<float>::quiet_NaN ();
+    return;
+  }
+  double mean[3] = { sums[0] / count, sums[1] / count, sums[2] / count };
+  Eigen::Matrix3f covariance;
+  covariance (0, 0) = static_cast<float> (sums[3] / count - mean[0] * mean[0]);
+  covariance (0, 1) = covariance (1, 0) = static_cast<float> (sums[4] / count - mean[0] * mean[1]);
+  covariance (0, 2) = covariance (2, 0) = static_cast<float> (sums[5] / count - mean[0] * mean[2]);
+  covariance (1, 1) = static_cast<float> (sums[6] / count - mean[1] * mean[1]);
+  covariance (1, 2) = covariance (2, 1) = static_cast<float> (sums[7] / count - mean[1] * mean[2]);
+  covariance (2, 2) = static_cast<float> (sums[8] / count - mean[2] * mean[2]);
+  pcl::solvePlaneParameters (covariance, normal.normal_x, normal.normal_y, normal.normal_z, normal.curvature);
+  // Same default viewpoint as pcl::NormalEstimation
+  pcl::flipNormalTowardsViewpoint (point, 0.0f, 0.0f, 0.0f, normal.normal_x, normal.normal_y, normal.normal_z);
+}
+
+
+// ---------------------------------------------------------------
+// -----Normals at several radii from one neighbourhood search-----
+// ---------------------------------------------------------------
+// The search at the largest radius returns neighbours sorted by distance, so
+// every smaller radius is a prefix of the same list: the covariance sums are
+// accumulated once and read out each time a radius is passed. Returns one
+// normal cloud per radius, in the order the radii were given.
+inline std::vector<pcl::PointCloud<pcl::Normal>::Ptr>
+estimateMultiScaleNormals (const pcl::PointCloud<pcl::PointXYZ>::ConstPtr& cloud,
+                           const pcl::search::KdTree<pcl::PointXYZ>::Ptr& tree, const std::vector<double>& radii)
+{
+  pcl::console::TicToc tt;
+  tt.tic ();
+  const int num_radii = static_cast<int> (radii.size ());
+  const int n = static_cast<int> (cloud->points.size ());
+  std::vector<pcl::PointCloud<pcl::Normal>::Ptr> normals (num_radii);
+  if (num_radii == 0)
+    return (normals);
+
+  std::vector<std::pair<double, int> > scales (num_radii);
+  for (int s = 0; s < num_radii; ++s)
+  {
+    scales[s] = std::make_pair (radii[s], s);
+    normals[s].reset (new pcl::PointCloud<pcl::Normal>);
+    normals[s]->points.resize (n);
+    normals[s]->width = static_cast<uint32_t> (n);
+    normals[s]->height = 1;
+  }
+  std::sort (scales.begin (), scales.end ());
+  std::vector<size_t> invalid (num_radii, 0);
+
+#pragma omp parallel
+  {
+    std::vector<int> indices;
+    std::vector<float> sqr_distances;
+    std::vector<size_t> local_invalid (num_radii, 0);
+#pragma omp for schedule(dynamic, 256)
+    for (int i = 0; i < n; ++i)
+    {
+      const pcl::PointXYZ& point = cloud->points[i];
+      bool found = pcl::isFinite (point) && tree->radiusSearch (i, scales.back ().first, indices, sqr_distances) > 0;
+      if (!found)
+        indices.clear ();
+
+      double sums[9] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+      size_t j = 0;
+      for (int s = 0; s < num_radii; ++s)
+      {
+        const double sqr_radius = scales[s].first * scales[s].first;
+        for (; j < indices.size () && sqr_distances[j] <= sqr_radius; ++j)
+        {
+          const pcl::PointXYZ& neighbour = cloud->points[indices[j]];
+          double x = neighbour.x - point.x, y = neighbour.y - point.y, z = neighbour.z - point.z;
+          sums[0] += x;
+          sums[1] += y;
+          sums[2] += z;
+          sums[3] += x * x;
+          sums[4] += x * y;
+          sums[5] += x * z;
+          sums[6] += y * y;
+          sums[7] += y * z;
+          sums[8] += z * z;
+        }
+        pcl::Normal& normal = normals[scales[s].second]->points[i];
+        normalFromSums (point, j, sums, normal);
+        if (!pcl_isfinite (normal.normal_x))
+          ++local_invalid[scales[s].second];
+      }
+    }
+#pragma omp critical
+    for (int s = 0; s < num_radii; ++s)
+      invalid[s] += local_invalid[s];
+  }
+  for (int s = 0; s < num_radii; ++s)
+    normals[s]->is_dense = (invalid[s] == 0);
+
+  double ms = tt.toc ();
+  std::cout << "Estimated normals at " << num_radii << " radii in one search of radius " << scales.back ().first
+            << " in " << ms << " ms: " << n / (ms * 0.001 + 1e-9) << " points/s on " << getNumberOfThreads () << " threads\n";
+  return (normals);
+}
+
+
+// normalsVis draws an XYZRGB cloud; give a plain cloud one colour
+inline pcl::PointCloud<pcl::PointXYZRGB>::Ptr
+makeColourCloud (const pcl::PointCloud<pcl::PointXYZ>& cloud, uint8_t r, uint8_t g, uint8_t b)
+{
+  pcl::PointCloud<pcl::PointXYZRGB>::Ptr colour (new pcl::PointCloud<pcl::PointXYZRGB>);
+  colour->points.resize (cloud.points.size ());
+  colour->width = static_cast<uint32_t> (cloud.points.size ());
+  colour->height = 1;
+  uint32_t packed = (static_cast<uint32_t> (r) << 16 | static_cast<uint32_t> (g) << 8 | static_cast<uint32_t> (b));
+  float rgb;
+  std::memcpy (&rgb, &packed, sizeof (rgb));
+#pragma omp parallel for
+  for (int i = 0; i < static_cast<int> (cloud.points.size ()); ++i)
+  {
+    pcl::PointXYZRGB& point = colour->points[i];
+    point.x = cloud.points[i].x;
+    point.y = cloud.points[i].y;
+    point.z = cloud.points[i].z;
+    point.rgb = rgb;
+  }
+  return (colour);
+}
+
+#endif  // PCL_VISUALIZER_NORMALS_H_
@@ -0,0 +1,712 @@
+/* Out-of-core point storage for clouds that do not fit in memory                */
+/* The text file is preprocessed once into an adaptive octree whose leaves are   */
+/* stored as fixed-size pages in <file>.pvpages, described by <file>.pvindex.    */
+/* Pages are read on demand through an LRU cache bounded by a memory budget.     */
+
+#ifndef PCL_VISUALIZER_PAGED_CLOUD_H_
+#define PCL_VISUALIZER_PAGED_CLOUD_H_
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <list>
+#include <map>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/shared_ptr.hpp>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/console/time.h>
+#include <pcl/visualization/pcl_visualizer.h>
+
+#include "cloud_cache.h"
+#include "lod_octree.h"
+#include "xyz_loader.h"
+
+const uint32_t PAGED_CLOUD_VERSION = 1;
+const char PAGED_CLOUD_MAGIC[8] = { 'P', 'C', 'L', 'V', 'P', 'A', 'G', 'E' };
+const uint32_t PAGE_POINTS = 4096;                       // points per page
+const size_t PAGE_BYTES = PAGE_POINTS * 3 * sizeof (float);
+const uint32_t SUMMARY_POINTS = 256;                     // always resident per leaf
+const int HISTOGRAM_LEVELS = 7;                          // 128^3 finest grid
+
+struct PagedCloudHeader
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t page_points;
+  uint64_t source_size;
+  int64_t  source_mtime;
+  uint64_t source_hash;
+  uint64_t point_count;
+  uint32_t leaf_count;
+  uint32_t page_count;
+};
+
+struct PagedLeaf
+{
+  float    min_pt[3], max_pt[3];
+  uint64_t point_count;
+  uint32_t first_page;        // into PagedCloud::page_ids_
+  uint32_t page_count;
+};
+
+
+class PagedCloud
+{
+  public:
+    // mem_budget bounds the page cache, the resident summaries and the
+    // staging buffers used while preprocessing
+    PagedCloud (size_t mem_budget) : mem_budget_ (mem_budget), cache_capacity_ (0) {}
+
+    // Opens the page store of source, building it first if it is missing or stale
+    bool
+    open (const std::string& source)
+    {
+      CloudCacheKey key;
+      if (!getCacheKey (source, key))
+      {
+        std::cerr << "Could not open " << source << std::endl;
+        return (false);
+      }
+      index_path_ = source + ".pvindex";
+      pages_path_ = source + ".pvpages";
+      if (!readIndex (key))
+      {
+        std::cout << "Building out-of-core pages for " << source << "\n";
+        if (!build (source, key) || !readIndex (key))
+          return (false);
+      }
+      pages_.open (pages_path_.c_str (), std::ios::binary);
+      if (!pages_)
+      {
+        std::cerr << "Could not open " << pages_path_ << std::endl;
+        return (false);
+      }
+
+      size_t resident = summaries_.size () * sizeof (float);
+      cache_capacity_ = mem_budget_ > resident ? (mem_budget_ - resident) / PAGE_BYTES : 0;
+      cache_capacity_ = std::max<size_t> (cache_capacity_, 16);
+      std::cout << "Out-of-core store: " << point_count_ << " points in " << leaves_.size () << " leaves, "
+                << cache_capacity_ << " pages (" << cache_capacity_ * PAGE_BYTES / (1024 * 1024) << " MB) cached\n";
+      return (true);
+    }
+
+    // Fills out with about budget points chosen for camera, paging in what is missing
+    void
+    select (const pcl::visualization::Camera& camera, size_t budget, pcl::PointCloud<pcl::PointXYZ>& out)
+    {
+      std::vector<Eigen::Vector3f> box_min (leaves_.size ()), box_max (leaves_.size ());
+      std::vector<size_t> points (leaves_.size ()), counts;
+      for (size_t i = 0; i < leaves_.size (); ++i)
+      {
+        box_min[i] = Eigen::Vector3f (leaves_[i].min_pt[0], leaves_[i].min_pt[1], leaves_[i].min_pt[2]);
+        box_max[i] = Eigen::Vector3f (leaves_[i].max_pt[0], leaves_[i].max_pt[1], leaves_[i].max_pt[2]);
+        points[i] = leaves_[i].point_count;
+      }
+      // Never ask for more pages than the cache holds
+      budget = std::min (budget, cache_capacity_ * PAGE_POINTS);
+      distributeBudget (box_min, box_max, points, camera, budget, counts);
+
+      size_t total = 0;
+      for (size_t i = 0; i < counts.size (); ++i)
+        total += counts[i];
+      out.points.resize (total);
+      size_t n = 0;
+      for (size_t i = 0; i < leaves_.size (); ++i)
+      {
+        if (counts[i] == 0)
+          continue;
+        const PagedLeaf& leaf = leaves_[i];
+        // Pages of a leaf are shuffled, so a prefix is a uniform subsample
+        if (counts[i] <= SUMMARY_POINTS)
+        {
+          copyPoints (&summaries_[summary_offsets_[i] * 3], counts[i], &out.points[n]);
+          n += counts[i];
+          continue;
+        }
+        size_t remaining = counts[i];
+        for (uint32_t p = 0; p < leaf.page_count && remaining > 0; ++p)
+        {
+          uint32_t page = page_ids_[leaf.first_page + p];
+          size_t in_page = std::min<size_t> (PAGE_POINTS, leaf.point_count - static_cast<size_t> (p) * PAGE_POINTS);
+          size_t take = std::min (remaining, in_page);
+          PageBuffer buffer = getPage (page);
+          if (!buffer)
+            break;
+          copyPoints (&(*buffer)[0], take, &out.points[n]);
+          n += take;
+          remaining -= take;
+        }
+      }
+      out.points.resize (n);
+      out.width = static_cast<uint32_t> (n);
+      out.height = 1;
+      out.is_dense = true;
+    }
+
+    uint64_t
+    getPointCount () const
+    {
+      return (point_count_);
+    }
+
+    // Box around every leaf, i.e. around the whole cloud; false if empty
+    bool
+    getBounds (float* min_pt, float* max_pt) const
+    {
+      for (int k = 0; k < 3; ++k)
+      {
+        min_pt[k] = std::numeric_limits<float>::max ();
+        max_pt[k] = -std::numeric_limits<float>::max ();
+      }
+      for (size_t i = 0; i < leaves_.size (); ++i)
+        for (int k = 0; k < 3; ++k)
+          if (leaves_[i].point_count)
+          {
+            min_pt[k] = std::min (min_pt[k], leaves_[i].min_pt[k]);
+            max_pt[k] = std::max (max_pt[k], leaves_[i].max_pt[k]);
+          }
+      return (min_pt[0] <= max_pt[0]);
+    }
+
+  private:
+    typedef boost::shared_ptr<std::vector<float> > PageBuffer;
+
+    // A node of the histogram octree: its point count and its cell at level
+    struct HistogramNode
+    {
+      HistogramNode (uint64_t count, int level, int x, int y, int z) :
+        count (count), level (level), x (x), y (y), z (z) {}
+
+      bool
+      operator< (const HistogramNode& other) const
+      {
+        return (count < other.count);
+      }
+
+      uint64_t count;
+      int level, x, y, z;
+    };
+
+    static void
+    copyPoints (const float* xyz, size_t count, pcl::PointXYZ* out)
+    {
+      for (size_t i = 0; i < count; ++i)
+      {
+        out[i].x = xyz[3 * i];
+        out[i].y = xyz[3 * i + 1];
+        out[i].z = xyz[3 * i + 2];
+      }
+    }
+
+    // ---------------------------
+    // -----LRU page cache-----
+    // ---------------------------
+    // Null if the page could not be read in full; it is not cached then
+    PageBuffer
+    getPage (uint32_t page)
+    {
+      std::map<uint32_t, std::list<std::pair<uint32_t, PageBuffer> >::iterator>::iterator it = lookup_.find (page);
+      if (it != lookup_.end ())
+      {
+        lru_.splice (lru_.begin (), lru_, it->second);
+        return (it->second->second);
+      }
+
+      PageBuffer buffer;
+      if (lru_.size () >= cache_capacity_)
+      {
+        // Recycle the least recently used buffer
+        buffer = lru_.back ().second;
+        lookup_.erase (lru_.back ().first);
+        lru_.pop_back ();
+      }
+      else
+        buffer.reset (new std::vector<float> (PAGE_POINTS * 3));
+      pages_.clear ();
+      pages_.seekg (static_cast<std::streamoff> (page) * PAGE_BYTES);
+      pages_.read (reinterpret_cast<char*> (&(*buffer)[0]), PAGE_BYTES);
+      if (pages_.gcount () != static_cast<std::streamsize> (PAGE_BYTES))
+      {
+        // A short read would leave another page's points in the buffer
+        std::cerr << "Could not read page " << page << " of " << pages_path_ << std::endl;
+        return (PageBuffer ());
+      }
+
+      lru_.push_front (std::make_pair (page, buffer));
+      lookup_[page] = lru_.begin ();
+      return (buffer);
+    }
+
+    // --------------------
+    // -----Index file-----
+    // --------------------
+    bool
+    readIndex (const CloudCacheKey& key)
+    {
+      std::ifstream in (index_path_.c_str (), std::ios::binary);
+      if (!in || !boost::filesystem::exists (pages_path_))
+        return (false);
+      PagedCloudHeader header;
+      in.read (reinterpret_cast<char*> (&header), sizeof (header));
+      if (!in || std::memcmp (header.magic, PAGED_CLOUD_MAGIC, sizeof (header.magic)) != 0 ||
+          header.version != PAGED_CLOUD_VERSION || header.page_points != PAGE_POINTS)
+        return (false);
+      if (header.source_size != key.size || header.source_mtime != key.mtime || header.source_hash != key.hash)
+      {
+        std::cout << "Out-of-core pages in " << pages_path_ << " are stale, rebuilding them\n";
+        return (false);
+      }
+
+      // The index must fit its file and point at pages the page file has;
+      // anything else is rebuilt rather than read out of bounds
+      boost::system::error_code ec;
+      uintmax_t index_bytes = boost::filesystem::file_size (index_path_, ec);
+      uintmax_t page_file_pages = boost::filesystem::file_size (pages_path_, ec) / PAGE_BYTES;
+      if (ec || sizeof (header) + static_cast<uintmax_t> (header.leaf_count) * sizeof (PagedLeaf) +
+                static_cast<uintmax_t> (header.page_count) * sizeof (uint32_t) > index_bytes)
+        return (damagedIndex ());
+
+      point_count_ = header.point_count;
+      leaves_.resize (header.leaf_count);
+      page_ids_.resize (header.page_count);
+      if (!leaves_.empty ())
+        in.read (reinterpret_cast<char*> (&leaves_[0]), leaves_.size () * sizeof (PagedLeaf));
+      if (!page_ids_.empty ())
+        in.read (reinterpret_cast<char*> (&page_ids_[0]), page_ids_.size () * sizeof (uint32_t));
+      if (!in)
+        return (damagedIndex ());
+
+      uint64_t points = 0;
+      for (size_t i = 0; i < leaves_.size (); ++i)
+      {
+        const PagedLeaf& leaf = leaves_[i];
+        if (static_cast<uint64_t> (leaf.first_page) + leaf.page_count > page_ids_.size () ||
+            leaf.point_count > static_cast<uint64_t> (leaf.page_count) * PAGE_POINTS)
+          return (damagedIndex ());
+        points += leaf.point_count;
+      }
+      for (size_t i = 0; i < page_ids_.size (); ++i)
+        if (page_ids_[i] >= page_file_pages)
+          return (damagedIndex ());
+      if (points != point_count_)
+        return (damagedIndex ());
+
+      summary_offsets_.assign (leaves_.size () + 1, 0);
+      for (size_t i = 0; i < leaves_.size (); ++i)
+        summary_offsets_[i + 1] = summary_offsets_[i] + std::min<uint64_t> (leaves_[i].point_count, SUMMARY_POINTS);
+      if (index_bytes - static_cast<uintmax_t> (in.tellg ()) < summary_offsets_.back () * 3 * sizeof (float))
+        return (damagedIndex ());
+      summaries_.resize (summary_offsets_.back () * 3);
+      if (!summaries_.empty ())
+        in.read (reinterpret_cast<char*> (&summaries_[0]), summaries_.size () * sizeof (float));
+      if (!in)
+        return (damagedIndex ());
+      return (true);
+    }
+
+    bool
+    damagedIndex ()
+    {
+      std::cout << "Out-of-core pages in " << pages_path_ << " are damaged, rebuilding them\n";
+      leaves_.clear ();
+      page_ids_.clear ();
+      summaries_.clear ();
+      summary_offsets_.clear ();
+      return (false);
+    }
+
+    // --------------------------------------------------
+    // -----One-off preprocessing of the text file-----
+    // --------------------------------------------------
+    // 1. bounds and count, 2. a 128^3 occupancy histogram, from which an
+    // octree of at most max_leaves nodes is cut, each node aiming at `target`
+    // points, 3. points are binned into one staging page per node that is
+    // appended to the page file when full; a node that reaches target points
+    // goes on in a new leaf, so dense cells are split by point order and no
+    // leaf holds more, 4. the pages of every leaf are shuffled in memory and
+    // the first points of each leaf are kept as its resident summary.
+    bool
+    build (const std::string& source, const CloudCacheKey& key)
+    {
+      pcl::console::TicToc tt;
+      tt.tic ();
+      const size_t block = 64 << 20;
+
+      min_[0] = min_[1] = min_[2] = std::numeric_limits<float>::max ();
+      float max_pt[3] = { -std::numeric_limits<float>::max (), -std::numeric_limits<float>::max (),
+                          -std::numeric_limits<float>::max () };
+      point_count_ = 0;
+      if (!forEachXYZBlock (source, block, boost::bind (&PagedCloud::accumulateBounds, this, _1, max_pt)))
+        return (failBuild (source));
+      if (point_count_ == 0)
+      {
+        std::cerr << "No points in " << source << std::endl;
+        return (false);
+      }
+      float size = std::max (max_pt[0] - min_[0], std::max (max_pt[1] - min_[1], max_pt[2] - min_[2]));
+      const int resolution = 1 << HISTOGRAM_LEVELS;
+      cell_size_ = std::max (size / resolution, std::numeric_limits<float>::min ()) * 1.0001f;
+
+      // Staging needs one page per node, so there are as many as fit half the
+      // budget; a whole leaf is shuffled in memory, so it holds at most a
+      // quarter of it. Leaves are whole pages.
+      histogram_.assign (static_cast<size_t> (resolution) * resolution * resolution, 0);
+      if (!forEachXYZBlock (source, block, boost::bind (&PagedCloud::accumulateHistogram, this, _1)))
+        return (failBuild (source));
+      size_t max_leaves = std::max<size_t> (mem_budget_ / 2 / PAGE_BYTES, 64);
+      uint64_t target_pages = (point_count_ / max_leaves + PAGE_POINTS) / PAGE_POINTS;
+      target_pages = std::max<uint64_t> (4, std::min<uint64_t> (target_pages, mem_budget_ / 4 / PAGE_BYTES));
+      leaf_target_ = target_pages * PAGE_POINTS;
+      cutLeaves (leaf_target_, max_leaves);
+      histogram_.clear ();
+
+      // Bin the points into pages
+      {
+        std::ofstream pages (pages_path_.c_str (), std::ios::binary | std::ios::trunc);
+        const size_t nodes = leaves_.size ();
+        staging_.assign (nodes, std::vector<float> ());
+        leaf_pages_.assign (nodes, std::vector<uint32_t> ());
+        node_leaf_.resize (nodes);
+        for (size_t i = 0; i < nodes; ++i)
+        {
+          resetLeaf (leaves_[i]);
+          node_leaf_[i] = static_cast<uint32_t> (i);
+        }
+        page_count_ = 0;
+        bool binned = forEachXYZBlock (source, block, boost::bind (&PagedCloud::binPoints, this, _1, boost::ref (pages)));
+        for (size_t i = 0; binned && i < nodes; ++i)
+          if (!staging_[i].empty ())
+          {
+            staging_[i].resize (PAGE_POINTS * 3, 0.0f);
+            writePage (pages, i);
+          }
+        staging_.clear ();
+        cell_leaf_.clear ();
+        node_leaf_.clear ();
+        // Every pass must see the same points, or the file changed under us
+        uint64_t binned_points = 0;
+        for (size_t i = 0; i < leaves_.size (); ++i)
+          binned_points += leaves_[i].point_count;
+        bool written = static_cast<bool> (pages);
+        pages.close ();
+        if (!binned || binned_points != point_count_)
+          return (failBuild (source));
+        if (!written)
+        {
+          std::cerr << "Could not write " << pages_path_ << std::endl;
+          return (failBuild (source));
+        }
+      }
+
+      // Shuffle each leaf across its pages, at most leaf_target_ points, and
+      // write the index
+      std::fstream pages (pages_path_.c_str (), std::ios::binary | std::ios::in | std::ios::out);
+      page_ids_.clear ();
+      summaries_.clear ();
+      std::vector<float> points;
+      for (size_t i = 0; i < leaves_.size (); ++i)
+      {
+        leaves_[i].first_page = static_cast<uint32_t> (page_ids_.size ());
+        leaves_[i].page_count = static_cast<uint32_t> (leaf_pages_[i].size ());
+        page_ids_.insert (page_ids_.end (), leaf_pages_[i].begin (), leaf_pages_[i].end ());
+
+        points.resize (leaf_pages_[i].size () * PAGE_POINTS * 3);
+        for (size_t p = 0; p < leaf_pages_[i].size (); ++p)
+        {
+          pages.seekg (static_cast<std::streamoff> (leaf_pages_[i][p]) * PAGE_BYTES);
+          pages.read (reinterpret_cast<char*> (&points[p * PAGE_POINTS * 3]), PAGE_BYTES);
+        }
+        uint32_t state = 2654435761u * static_cast<uint32_t> (i + 1);
+        for (size_t j = leaves_[i].point_count; j > 1; --j)
+        {
+          state ^= state << 13;
+          state ^= state >> 17;
+          state ^= state << 5;
+          size_t k = state % j;
+          for (int c = 0; c < 3; ++c)
+            std::swap (points[3 * (j - 1) + c], points[3 * k + c]);
+        }
+        for (size_t p = 0; p < leaf_pages_[i].size (); ++p)
+        {
+          pages.seekp (static_cast<std::streamoff> (leaf_pages_[i][p]) * PAGE_BYTES);
+          pages.write (reinterpret_cast<const char*> (&points[p * PAGE_POINTS * 3]), PAGE_BYTES);
+        }
+        size_t summary = std::min<uint64_t> (leaves_[i].point_count, SUMMARY_POINTS);
+        summaries_.insert (summaries_.end (), points.begin (), points.begin () + 3 * summary);
+      }
+      leaf_pages_.clear ();
+      if (!pages)
+      {
+        std::cerr << "Could not write " << pages_path_ << std::endl;
+        pages.close ();
+        return (failBuild (source));
+      }
+
+      PagedCloudHeader header;
+      std::memset (&header, 0, sizeof (header));
+      std::memcpy (header.magic, PAGED_CLOUD_MAGIC, sizeof (header.magic));
+      header.version = PAGED_CLOUD_VERSION;
+      header.page_points = PAGE_POINTS;
+      header.source_size = key.size;
+      header.source_mtime = key.mtime;
+      header.source_hash = key.hash;
+      header.point_count = point_count_;
+      header.leaf_count = static_cast<uint32_t> (leaves_.size ());
+      header.page_count = static_cast<uint32_t> (page_ids_.size ());
+      std::ofstream index (index_path_.c_str (), std::ios::binary | std::ios::trunc);
+      index.write (reinterpret_cast<const char*> (&header), sizeof (header));
+      index.write (reinterpret_cast<const char*> (&leaves_[0]), leaves_.size () * sizeof (PagedLeaf));
+      index.write (reinterpret_cast<const char*> (&page_ids_[0]), page_ids_.size () * sizeof (uint32_t));
+      index.write (reinterpret_cast<const char*> (&summaries_[0]), summaries_.size () * sizeof (float));
+      if (!index)
+      {
+        std::cerr << "Could not write " << index_path_ << std::endl;
+        index.close ();
+        return (failBuild (source));
+      }
+      std::cout << "Built " << leaves_.size () << " leaves and " << page_ids_.size () << " pages in "
+                << tt.toc () << " ms\n";
+      return (true);
+    }
+
+    // Nothing of a failed build is kept, so no later run takes it for a
+    // store of source
+    bool
+    failBuild (const std::string& source)
+    {
+      std::cerr << "Could not build out-of-core pages for " << source << std::endl;
+      histogram_.clear ();
+      staging_.clear ();
+      cell_leaf_.clear ();
+      node_leaf_.clear ();
+      leaf_pages_.clear ();
+      leaves_.clear ();
+      page_ids_.clear ();
+      summaries_.clear ();
+      boost::system::error_code ec;
+      boost::filesystem::remove (pages_path_, ec);
+      boost::filesystem::remove (index_path_, ec);
+      return (false);
+    }
+
+    void
+    accumulateBounds (const pcl::PointCloud<pcl::PointXYZ>& block, float* max_pt)
+    {
+      for (size_t i = 0; i < block.points.size (); ++i)
+        for (int k = 0; k < 3; ++k)
+        {
+          min_[k] = std::min (min_[k], block.points[i].data[k]);
+          max_pt[k] = std::max (max_pt[k], block.points[i].data[k]);
+        }
+      point_count_ += block.points.size ();
+    }
+
+    size_t
+    getCell (const pcl::PointXYZ& p) const
+    {
+      const int resolution = 1 << HISTOGRAM_LEVELS;
+      size_t cell = 0;
+      for (int k = 0; k < 3; ++k)
+      {
+        int c = static_cast<int> ((p.data[k] - min_[k]) / cell_size_);
+        cell = cell * resolution + std::max (0, std::min (resolution - 1, c));
+      }
+      return (cell);
+    }
+
+    void
+    accumulateHistogram (const pcl::PointCloud<pcl::PointXYZ>& block)
+    {
+      for (size_t i = 0; i < block.points.size (); ++i)
+        ++histogram_[getCell (block.points[i])];
+    }
+
+    // Splits the histogram octree, fullest node first, until nodes hold at
+    // most target points, are single cells or a split would make more than
+    // max_leaves nodes; maps every cell to its node. A node over target is
+    // split further by point order while binning.
+    void
+    cutLeaves (uint64_t target, size_t max_leaves)
+    {
+      // Count pyramid; level 0 is the histogram itself
+      std::vector<std::vector<uint64_t> > levels (HISTOGRAM_LEVELS + 1);
+      levels[0].assign (histogram_.begin (), histogram_.end ());
+      for (int l = 1; l <= HISTOGRAM_LEVELS; ++l)
+      {
+        int r = 1 << (HISTOGRAM_LEVELS - l), fine = r * 2;
+        levels[l].assign (static_cast<size_t> (r) * r * r, 0);
+        for (int x = 0; x < fine; ++x)
+          for (int y = 0; y < fine; ++y)
+            for (int z = 0; z < fine; ++z)
+              levels[l][((x / 2) * r + y / 2) * r + z / 2] += levels[l - 1][(static_cast<size_t> (x) * fine + y) * fine + z];
+      }
+      leaves_.clear ();
+      cell_leaf_.assign (histogram_.size (), 0);
+
+      std::priority_queue<HistogramNode> open;
+      open.push (HistogramNode (levels[HISTOGRAM_LEVELS][0], HISTOGRAM_LEVELS, 0, 0, 0));
+      size_t nodes = 1;
+      std::vector<HistogramNode> children;
+      while (!open.empty ())
+      {
+        HistogramNode node = open.top ();
+        open.pop ();
+        if (node.count > target && node.level > 0)
+        {
+          int r = 1 << (HISTOGRAM_LEVELS - node.level + 1);
+          children.clear ();
+          for (int c = 0; c < 8; ++c)
+          {
+            int x = 2 * node.x + ((c >> 2) & 1), y = 2 * node.y + ((c >> 1) & 1), z = 2 * node.z + (c & 1);
+            uint64_t count = levels[node.level - 1][(static_cast<size_t> (x) * r + y) * r + z];
+            if (count)
+              children.push_back (HistogramNode (count, node.level - 1, x, y, z));
+          }
+          if (nodes - 1 + children.size () <= max_leaves)
+          {
+            for (size_t c = 0; c < children.size (); ++c)
+              open.push (children[c]);
+            nodes += children.size () - 1;
+            continue;
+          }
+        }
+        addLeaf (node);
+      }
+    }
+
+    void
+    addLeaf (const HistogramNode& node)
+    {
+      uint32_t leaf = static_cast<uint32_t> (leaves_.size ());
+      leaves_.push_back (PagedLeaf ());
+      const int resolution = 1 << HISTOGRAM_LEVELS, span = 1 << node.level;
+      for (int i = node.x * span; i < (node.x + 1) * span; ++i)
+        for (int j = node.y * span; j < (node.y + 1) * span; ++j)
+          for (int k = node.z * span; k < (node.z + 1) * span; ++k)
+            cell_leaf_[(static_cast<size_t> (i) * resolution + j) * resolution + k] = leaf;
+    }
+
+    static void
+    resetLeaf (PagedLeaf& leaf)
+    {
+      leaf.point_count = 0;
+      for (int k = 0; k < 3; ++k)
+      {
+        leaf.min_pt[k] = std::numeric_limits<float>::max ();
+        leaf.max_pt[k] = -std::numeric_limits<float>::max ();
+      }
+    }
+
+    void
+    binPoints (const pcl::PointCloud<pcl::PointXYZ>& block, std::ofstream& pages)
+    {
+      for (size_t i = 0; i < block.points.size (); ++i)
+      {
+        const pcl::PointXYZ& p = block.points[i];
+        uint32_t node = cell_leaf_[getCell (p)];
+        if (leaves_[node_leaf_[node]].point_count == leaf_target_)
+        {
+          // Full, and its staging page was just written: go on in a new leaf
+          node_leaf_[node] = static_cast<uint32_t> (leaves_.size ());
+          leaves_.push_back (PagedLeaf ());
+          resetLeaf (leaves_.back ());
+          leaf_pages_.push_back (std::vector<uint32_t> ());
+        }
+        PagedLeaf& leaf = leaves_[node_leaf_[node]];
+        for (int k = 0; k < 3; ++k)
+        {
+          leaf.min_pt[k] = std::min (leaf.min_pt[k], p.data[k]);
+          leaf.max_pt[k] = std::max (leaf.max_pt[k], p.data[k]);
+        }
+        ++leaf.point_count;
+        std::vector<float>& staging = staging_[node];
+        staging.push_back (p.x);
+        staging.push_back (p.y);
+        staging.push_back (p.z);
+        if (staging.size () == PAGE_POINTS * 3)
+          writePage (pages, node);
+      }
+    }
+
+    void
+    writePage (std::ofstream& pages, size_t node)
+    {
+      pages.write (reinterpret_cast<const char*> (&staging_[node][0]), PAGE_BYTES);
+      leaf_pages_[node_leaf_[node]].push_back (page_count_++);
+      staging_[node].clear ();
+    }
+
+    size_t mem_budget_, cache_capacity_;
+    std::string index_path_, pages_path_;
+    std::ifstream pages_;
+
+    uint64_t point_count_;
+    std::vector<PagedLeaf> leaves_;
+    std::vector<uint32_t> page_ids_;
+    std::vector<float> summaries_;
+    std::vector<size_t> summary_offsets_;
+
+    std::list<std::pair<uint32_t, PageBuffer> > lru_;
+    std::map<uint32_t, std::list<std::pair<uint32_t, PageBuffer> >::iterator> lookup_;
+
+    // Only used while building; cell_leaf_ gives the node of a cell,
+    // node_leaf_ the leaf its points go to now, staging_ is per node
+    float min_[3], cell_size_;
+    uint64_t leaf_target_;
+    std::vector<uint32_t> histogram_, cell_leaf_, node_leaf_;
+    std::vector<std::vector<float> > staging_;
+    std::vector<std::vector<uint32_t> > leaf_pages_;
+    uint32_t page_count_;
+};
+
+
+// ---------------------------------------------------------------------------
+// -----Keeps the displayed part of an out-of-core cloud in step with the camera-----
+// ---------------------------------------------------------------------------
+class PagedRenderer : public BudgetRenderer
+{
+  public:
+    PagedRenderer (size_t mem_budget, size_t budget) : BudgetRenderer (budget), store_ (mem_budget) {}
+
+    bool
+    open (const std::string& source)
+    {
+      return (store_.open (source));
+    }
+
+    uint64_t
+    getPointCount () const
+    {
+      return (store_.getPointCount ());
+    }
+
+    bool
+    getBounds (float* min_pt, float* max_pt) const
+    {
+      return (store_.getBounds (min_pt, max_pt));
+    }
+
+    bool
+    select (const pcl::visualization::Camera& camera)
+    {
+      store_.select (camera, budget_, *display_);
+      watch_.reset (camera);
+      return (true);
+    }
+
+  private:
+    PagedCloud store_;
+};
+
+#endif  // PCL_VISUALIZER_PAGED_CLOUD_H_
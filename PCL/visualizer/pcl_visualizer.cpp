@@ -2,8 +2,13 @@
 /* Original Author: Geoffrey Biggs                                              */
 /* Modified to read x, y, z information from a text file                        */
 
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <sstream>
 
+#include <boost/bind.hpp>
 #include <boost/thread/thread.hpp>
 #include <pcl/common/common_headers.h>
 #include <pcl/features/normal_3d.h>
@@ -11,6 +16,28 @@
 #include <pcl/visualization/pcl_visualizer.h>
 #include <pcl/console/parse.h>
 
+#include "annotations.h"
+#include "batch.h"
+#include "bench.h"
+#include "binary_loader.h"
+#include "camera.h"
+#include "cloud_diff.h"
+#include "cloud_cache.h"
+#include "filter_pipeline.h"
+#include "field_colour.h"
+#include "follow.h"
+#include "grid_loader.h"
+#include "lod_octree.h"
+#include "normals.h"
+#include "paged_cloud.h"
+#include "perf_hud.h"
+#include "picking.h"
+#include "shm_cloud.h"
+#include "splat_renderer.h"
+#include "stream_loader.h"
+#include "update_loop.h"
+#include "xyz_loader.h"
+
 // --------------
 // -----Help-----
 // --------------
@@ -21,7 +48,43 @@ printUsage (const char* progName)
             << "Options:\n"
             << "-------------------------------------------\n"
             << "-h           this help\n"
-            << "-f           Specify text file containing XYZ information\n"
+            << "-f           Specify text file containing XYZ, XYZI or XYZRGB information (may be .gz or .zst),\n"
+            << "             or a binary little-endian PLY or LAS 1.2 - 1.4 file\n"
+            << "             (give -f several times to load the files in parallel into a grid of linked views;\n"
+            << "             only -c, --pipeline, --no-cache and --perf-log apply to the grid)\n"
+            << "-c           Draw an XYZ cloud in a single custom colour\n"
+            << "--colour-by  Colour the cloud by z, range (distance to the origin) or intensity, blue to red over\n"
+            << "             the whole cloud ('k' in the viewer cycles an XYZ cloud through none, z and range)\n"
+            << "-n           Estimate normals at these search radii (e.g. 0.01,0.1) and show them\n"
+            << "--no-cache   Do not read or write the binary <file>.pvcache sidecar\n"
+            << "--stream     Open the viewer right away and add points while the file is parsed\n"
+            << "--stream-ms  Milliseconds between display updates while streaming (default 250)\n"
+            << "--lod        Draw through a level-of-detail octree (default above --lod-min points)\n"
+            << "--lod-min    Point count above which the octree is used (default 50000000)\n"
+            << "--budget     Points drawn per frame by the octree (default 2000000)\n"
+            << "--compact    Keep the octree's points as 16 or 21 bit steps no further than this from the originals\n"
+            << "             and free the loaded cloud (implies --lod; XYZ only)\n"
+            << "--follow     Keep reading points appended to the file and add them to the view\n"
+            << "--ooc        Out-of-core: page the cloud from <file>.pvpages instead of loading it\n"
+            << "--mem-budget Megabytes of pages kept in memory with --ooc (default 1024)\n"
+            << "--bench      Run the pipeline without a viewer and print stage timings as JSON\n"
+            << "--bench-out  Append the --bench JSON line to this file instead of printing it\n"
+            << "--pipeline   Filter the cloud after loading, e.g. crop:x0,y0,z0,x1,y1,z1,pass:z,0,10,voxel:0.05,sor:50,1.0\n"
+            << "--perf-log   Append frame rate, points drawn, upload and memory to this file as JSON once a second\n"
+            << "             ('i' in the viewer shows the same numbers on screen)\n"
+            << "--shm        Show the frames a producer writes to this shared memory segment instead of -f\n"
+            << "--diff       Colour every point by its distance to the nearest point of this reference file\n"
+            << "--diff-max   Distance shown in red by --diff (default the 99th percentile)\n"
+            << "--render     Draw the cloud on the CPU into this PNG file and exit, without a display\n"
+            << "--render-depth  Also write the depth along the view to this 16 bit PNG file, in steps of\n"
+            << "             --depth-unit (default 0.001, i.e. millimetres for a cloud in metres)\n"
+            << "--render-size   Width,height of the rendered images (default 1280,960)\n"
+            << "--splat-size    Diameter of a rendered point in cloud units (default from the point spacing)\n"
+            << "--batch      Load every point file of this directory on a pool of workers and write their statistics\n"
+            << "             as JSON lines; takes --pipeline, --no-cache, --render-size and --splat-size\n"
+            << "--batch-out  Append the --batch statistics to this file instead of printing them\n"
+            << "--snapshots  Directory for a rendered <file>.png of every --batch file\n"
+            << "--workers    Files processed at once by --batch (default one per thread)\n"
             << "\n\n";
 }
 
@@ -73,6 +136,61 @@ boost::shared_ptr<pcl::visualization::PCLVisualizer> customColourVis (pcl::Point
 }
 
 
+boost::shared_ptr<pcl::visualization::PCLVisualizer> intensityVis (pcl::PointCloud<pcl::PointXYZI>::ConstPtr cloud)
+{
+  // --------------------------------------------
+  // -----Open 3D viewer and add point cloud-----
+  // --------------------------------------------
+  boost::shared_ptr<pcl::visualization::PCLVisualizer> viewer (new pcl::visualization::PCLVisualizer ("3D Viewer"));
+  viewer->setBackgroundColor (0, 0, 0);
+  pcl::visualization::PointCloudColorHandlerGenericField<pcl::PointXYZI> intensity(cloud, "intensity");
+  viewer->addPointCloud<pcl::PointXYZI> (cloud, intensity, "sample cloud");
+  viewer->setPointCloudRenderingProperties (pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 1, "sample cloud");
+  viewer->addCoordinateSystem (1.0);
+  viewer->initCameraParameters ();
+  return (viewer);
+}
+
+
+template <typename PointT>
+boost::shared_ptr<pcl::visualization::PCLVisualizer> fieldVis (typename pcl::PointCloud<PointT>::ConstPtr cloud,
+                                                               ColourField field, const FieldRange& range)
+{
+  // --------------------------------------------
+  // -----Open 3D viewer and add point cloud-----
+  // --------------------------------------------
+  boost::shared_ptr<pcl::visualization::PCLVisualizer> viewer (new pcl::visualization::PCLVisualizer ("3D Viewer"));
+  viewer->setBackgroundColor (0, 0, 0);
+  PointCloudColorHandlerField<PointT> colour(cloud, field, range);
+  viewer->addPointCloud<PointT> (cloud, colour, "sample cloud");
+  viewer->setPointCloudRenderingProperties (pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 1, "sample cloud");
+  viewer->addCoordinateSystem (1.0);
+  viewer->initCameraParameters ();
+  return (viewer);
+}
+
+
+boost::shared_ptr<pcl::visualization::PCLVisualizer> diffVis (
+    pcl::PointCloud<pcl::PointXYZ>::ConstPtr cloud, const boost::shared_ptr<const std::vector<float> >& distances,
+    float max, const std::string& reference)
+{
+  // --------------------------------------------
+  // -----Open 3D viewer and add point cloud-----
+  // --------------------------------------------
+  boost::shared_ptr<pcl::visualization::PCLVisualizer> viewer (new pcl::visualization::PCLVisualizer ("3D Viewer"));
+  viewer->setBackgroundColor (0, 0, 0);
+  PointCloudColorHandlerDistance distance(cloud, distances, max);
+  viewer->addPointCloud<pcl::PointXYZ> (cloud, distance, "sample cloud");
+  viewer->setPointCloudRenderingProperties (pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 1, "sample cloud");
+  std::ostringstream legend;
+  legend << "Distance to " << reference << ": 0 (blue) to " << max << " (red)";
+  viewer->addText (legend.str (), 10, 10, "diff legend");
+  viewer->addCoordinateSystem (1.0);
+  viewer->initCameraParameters ();
+  return (viewer);
+}
+
+
 boost::shared_ptr<pcl::visualization::PCLVisualizer> normalsVis (
     pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr cloud, pcl::PointCloud<pcl::Normal>::ConstPtr normals)
 {
@@ -135,7 +253,8 @@ boost::shared_ptr<pcl::visualization::PCLVisualizer> shapesVis (pcl::PointCloud<
 
 
 boost::shared_ptr<pcl::visualization::PCLVisualizer> viewportsVis (
-    pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr cloud, pcl::PointCloud<pcl::Normal>::ConstPtr normals1, pcl::PointCloud<pcl::Normal>::ConstPtr normals2)
+    pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr cloud, const std::vector<pcl::PointCloud<pcl::Normal>::Ptr>& normals,
+    const std::vector<double>& radii)
 {
   // --------------------------------------------------------
   // -----Open 3D viewer and add point cloud and normals-----
@@ -143,77 +262,545 @@ boost::shared_ptr<pcl::visualization::PCLVisualizer> viewportsVis (
   boost::shared_ptr<pcl::visualization::PCLVisualizer> viewer (new pcl::visualization::PCLVisualizer ("3D Viewer"));
   viewer->initCameraParameters ();
 
-  int v1(0);
-  viewer->createViewPort(0.0, 0.0, 0.5, 1.0, v1);
-  viewer->setBackgroundColor (0, 0, 0, v1);
-  viewer->addText("Radius: 0.01", 10, 10, "v1 text", v1);
+  // One viewport per radius, side by side; the first keeps the cloud colours
   pcl::visualization::PointCloudColorHandlerRGBField<pcl::PointXYZRGB> rgb(cloud);
-  viewer->addPointCloud<pcl::PointXYZRGB> (cloud, rgb, "sample cloud1", v1);
-
-  int v2(0);
-  viewer->createViewPort(0.5, 0.0, 1.0, 1.0, v2);
-  viewer->setBackgroundColor (0.3, 0.3, 0.3, v2);
-  viewer->addText("Radius: 0.1", 10, 10, "v2 text", v2);
   pcl::visualization::PointCloudColorHandlerCustom<pcl::PointXYZRGB> single_color(cloud, 0, 255, 0);
-  viewer->addPointCloud<pcl::PointXYZRGB> (cloud, single_color, "sample cloud2", v2);
+  const size_t n = normals.size ();
+  for (size_t i = 0; i < n; ++i)
+  {
+    char id[64], text[64];
+    int v(0);
+    viewer->createViewPort(static_cast<double> (i) / n, 0.0, static_cast<double> (i + 1) / n, 1.0, v);
+    viewer->setBackgroundColor (i ? 0.3 : 0.0, i ? 0.3 : 0.0, i ? 0.3 : 0.0, v);
+    sprintf (id, "v%d text", static_cast<int> (i + 1));
+    sprintf (text, "Radius: %g", radii[i]);
+    viewer->addText(text, 10, 10, id, v);
+    sprintf (id, "sample cloud%d", static_cast<int> (i + 1));
+    if (i == 0)
+      viewer->addPointCloud<pcl::PointXYZRGB> (cloud, rgb, id, v);
+    else
+      viewer->addPointCloud<pcl::PointXYZRGB> (cloud, single_color, id, v);
+    viewer->setPointCloudRenderingProperties (pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 3, id);
+    sprintf (id, "normals%d", static_cast<int> (i + 1));
+    viewer->addPointCloudNormals<pcl::PointXYZRGB, pcl::Normal> (cloud, normals[i], 10, 0.05, id, v);
+  }
+  viewer->addCoordinateSystem (1.0);
+
+  return (viewer);
+}
+
 
-  viewer->setPointCloudRenderingProperties (pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 3, "sample cloud1");
-  viewer->setPointCloudRenderingProperties (pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 3, "sample cloud2");
+// Adds a cloud of the grid in the colours its single-file view would use
+void
+addGridCloud (pcl::visualization::PCLVisualizer& viewer, const pcl::PointCloud<pcl::PointXYZ>::ConstPtr& cloud,
+              const std::string& id, int viewport, bool custom_colour)
+{
+  if (custom_colour)
+  {
+    pcl::visualization::PointCloudColorHandlerCustom<pcl::PointXYZ> single_color(cloud, 0, 255, 0);
+    viewer.addPointCloud<pcl::PointXYZ> (cloud, single_color, id, viewport);
+  }
+  else
+    viewer.addPointCloud<pcl::PointXYZ> (cloud, id, viewport);
+}
+
+void
+addGridCloud (pcl::visualization::PCLVisualizer& viewer, const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr& cloud,
+              const std::string& id, int viewport, bool)
+{
+  pcl::visualization::PointCloudColorHandlerRGBField<pcl::PointXYZRGB> rgb(cloud);
+  viewer.addPointCloud<pcl::PointXYZRGB> (cloud, rgb, id, viewport);
+}
+
+void
+addGridCloud (pcl::visualization::PCLVisualizer& viewer, const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& cloud,
+              const std::string& id, int viewport, bool)
+{
+  pcl::visualization::PointCloudColorHandlerGenericField<pcl::PointXYZI> intensity(cloud, "intensity");
+  viewer.addPointCloud<pcl::PointXYZI> (cloud, intensity, id, viewport);
+}
+
+vtkRenderer*
+getViewportRenderer (pcl::visualization::PCLVisualizer& viewer, int viewport)
+{
+  vtkSmartPointer<vtkRendererCollection> renderers = viewer.getRendererCollection ();
+  renderers->InitTraversal ();
+  vtkRenderer* renderer = renderers->GetNextItem ();
+  for (int i = 0; i < viewport && renderer; ++i)
+    renderer = renderers->GetNextItem ();
+  return (renderer);
+}
+
+
+template <typename PointT> boost::shared_ptr<pcl::visualization::PCLVisualizer>
+gridVis (const std::vector<typename pcl::PointCloud<PointT>::Ptr>& clouds, const std::vector<std::string>& filenames,
+         bool custom_colour)
+{
+  // ----------------------------------------------------------
+  // -----Open 3D viewer with one viewport per point cloud-----
+  // ----------------------------------------------------------
+  boost::shared_ptr<pcl::visualization::PCLVisualizer> viewer (new pcl::visualization::PCLVisualizer ("3D Viewer"));
+  viewer->initCameraParameters ();
+
+  // As square a grid as the count allows, filled row by row from the top.
+  // Every viewport looks through the same vtkCamera, so moving one moves
+  // them all, and a cloud shown twice is one actor in two renderers, so its
+  // vertex buffer is uploaded once.
+  const int n = static_cast<int> (clouds.size ());
+  const int columns = static_cast<int> (std::ceil (std::sqrt (static_cast<double> (n))));
+  const int rows = (n + columns - 1) / columns;
+  vtkCamera* camera = NULL;
+  std::map<const void*, std::string> added;
+  Eigen::Vector4f min_all, max_all;
+  for (int i = 0; i < n; ++i)
+  {
+    char id[64];
+    int v(0);
+    int row = i / columns, column = i % columns;
+    viewer->createViewPort (static_cast<double> (column) / columns, 1.0 - static_cast<double> (row + 1) / rows,
+                            static_cast<double> (column + 1) / columns, 1.0 - static_cast<double> (row) / rows, v);
+    viewer->setBackgroundColor (0.0, 0.0, 0.0, v);
+    sprintf (id, "v%d text", i + 1);
+    viewer->addText (boost::filesystem::path (filenames[i]).filename ().string (), 10, 10, id, v);
+    vtkRenderer* renderer = getViewportRenderer (*viewer, v);
+    if (!camera)
+      camera = renderer->GetActiveCamera ();
+    else
+      renderer->SetActiveCamera (camera);
+
+    std::map<const void*, std::string>::const_iterator shared = added.find (clouds[i].get ());
+    if (shared != added.end ())
+    {
+      renderer->AddActor ((*viewer->getCloudActorMap ())[shared->second].actor);
+      continue;
+    }
+    sprintf (id, "sample cloud%d", i + 1);
+    addGridCloud (*viewer, clouds[i], id, v, custom_colour);
+    viewer->setPointCloudRenderingProperties (pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 1, id);
+    added[clouds[i].get ()] = id;
+
+    Eigen::Vector4f min_pt, max_pt;
+    pcl::getMinMax3D (*clouds[i], min_pt, max_pt);
+    min_all = (added.size () == 1 ? min_pt : Eigen::Vector4f (min_all.cwiseMin (min_pt)));
+    max_all = (added.size () == 1 ? max_pt : Eigen::Vector4f (max_all.cwiseMax (max_pt)));
+  }
   viewer->addCoordinateSystem (1.0);
 
-  viewer->addPointCloudNormals<pcl::PointXYZRGB, pcl::Normal> (cloud, normals1, 10, 0.05, "normals1", v1);
-  viewer->addPointCloudNormals<pcl::PointXYZRGB, pcl::Normal> (cloud, normals2, 10, 0.05, "normals2", v2);
+  // Fit the shared camera to all the clouds rather than to the last one
+  if (camera && min_all[0] <= max_all[0])
+  {
+    double bounds[6];
+    for (int axis = 0; axis < 3; ++axis)
+    {
+      bounds[2 * axis] = min_all[axis];
+      bounds[2 * axis + 1] = max_all[axis];
+    }
+    getViewportRenderer (*viewer, 1)->ResetCamera (bounds);
+  }
 
   return (viewer);
 }
 
 
-unsigned int text_id = 0;
+// -------------------------------------------------------------
+// -----What the event loop's tickers and callbacks work on-----
+// -------------------------------------------------------------
+struct ViewerState
+{
+  ViewerState () : write_cache (false), force_lod (false), custom_colour (false), recolour (false),
+                   colour_field (COLOUR_FIELD_NONE), lod_min (0), budget (0), stream_ms (0), last_update (0.0),
+                   update_cost (0.0), delta_id (0), shm_frames (0), loop (NULL), total_points (0) {}
+
+  // Actor of the points [begin, end) of cloud appended while following
+  struct Delta
+  {
+    std::string id;
+    size_t begin, end;
+  };
+
+  boost::shared_ptr<pcl::visualization::PCLVisualizer> viewer;
+  std::map<vtkRenderer*, boost::shared_ptr<AnnotationLayer> > annotations;   // one per viewport clicked
+  PointPicker::Ptr picker;
+  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud;
+  boost::shared_ptr<StreamLoader> loader;
+  BudgetRenderer::Ptr lod;
+  std::string filename;
+  CloudCacheKey cache_key;
+  bool write_cache, force_lod, custom_colour;
+  bool recolour;              // 'k' may switch colour_field
+  ColourField colour_field;
+  FieldRange colour_ranges[COLOUR_FIELD_COUNT];   // over the whole cloud, as they become known
+  size_t lod_min, budget;
+  int stream_ms;
+  pcl::console::TicToc load_time;
+  double last_update, update_cost;
+  boost::thread cache_writer;
+  boost::shared_ptr<FileFollower> follower;
+  std::vector<Delta> deltas;
+  unsigned int delta_id;
+  boost::shared_ptr<ShmCloudReader> shm;
+  pcl::PointCloud<pcl::PointXYZ>::Ptr spare;
+  unsigned int shm_frames;
+  boost::shared_ptr<PerfMonitor> perf;
+  UpdateLoop* loop;
+  size_t total_points;        // whole cloud, where the octree draws part of it
+};
+
+// Uploads cloud as the XYZ cloud id (adding it if it is new), keeping the
+// colour the "sample cloud" was shown in
+void
+updateSampleCloud (ViewerState& state, const pcl::PointCloud<pcl::PointXYZ>::ConstPtr& cloud,
+                   const std::string& id = "sample cloud")
+{
+  bool add = !state.viewer->contains (id);
+  if (state.perf)
+    state.perf->addUpload (cloud->points.size ());
+  if (state.colour_field != COLOUR_FIELD_NONE)
+  {
+    PointCloudColorHandlerField<pcl::PointXYZ> field (cloud, state.colour_field, state.colour_ranges[state.colour_field]);
+    if (add)
+      state.viewer->addPointCloud<pcl::PointXYZ> (cloud, field, id);
+    else
+      state.viewer->updatePointCloud<pcl::PointXYZ> (cloud, field, id);
+  }
+  else if (state.custom_colour)
+  {
+    pcl::visualization::PointCloudColorHandlerCustom<pcl::PointXYZ> single_color (cloud, 0, 255, 0);
+    if (add)
+      state.viewer->addPointCloud<pcl::PointXYZ> (cloud, single_color, id);
+    else
+      state.viewer->updatePointCloud<pcl::PointXYZ> (cloud, single_color, id);
+  }
+  else if (add)
+    state.viewer->addPointCloud<pcl::PointXYZ> (cloud, id);
+  else
+    state.viewer->updatePointCloud<pcl::PointXYZ> (cloud, id);
+
+  // Extra clouds, such as the --follow deltas, are drawn like the sample cloud
+  const int properties[] = { pcl::visualization::PCL_VISUALIZER_POINT_SIZE, pcl::visualization::PCL_VISUALIZER_OPACITY };
+  double value;
+  for (int i = 0; add && id != "sample cloud" && i < 2; ++i)
+    if (state.viewer->getPointCloudRenderingProperties (properties[i], value, "sample cloud"))
+      state.viewer->setPointCloudRenderingProperties (properties[i], value, id);
+}
+
+// The viewport under display pixel (x, y); the first renderer covers the
+// whole window when there are none
+vtkRenderer*
+getPokedRenderer (ViewerState& state, int x, int y)
+{
+  vtkRenderWindowInteractor* interactor = state.viewer->getRenderWindow ()->GetInteractor ();
+  vtkRenderer* renderer = (interactor ? interactor->FindPokedRenderer (x, y) : NULL);
+  return (renderer ? renderer : state.viewer->getRendererCollection ()->GetFirstRenderer ());
+}
+
+// Labels go to one layer per renderer instead of a text actor each, so they
+// show in the viewport that was clicked
+AnnotationLayer&
+getAnnotations (ViewerState& state, vtkRenderer* renderer)
+{
+  boost::shared_ptr<AnnotationLayer>& layer = state.annotations[renderer];
+  if (!layer)
+    layer.reset (new AnnotationLayer (renderer));
+  return (*layer);
+}
+
 void keyboardEventOccurred (const pcl::visualization::KeyboardEvent &event,
-                            void* viewer_void)
+                            void* state_void)
 {
-  pcl::visualization::PCLVisualizer *viewer = static_cast<pcl::visualization::PCLVisualizer *> (viewer_void);
+  ViewerState *state = static_cast<ViewerState *> (state_void);
   if (event.getKeySym () == "r" && event.keyDown ())
   {
     std::cout << "r was pressed => removing all text" << std::endl;
-
-    char str[512];
-    for (unsigned int i = 0; i < text_id; ++i)
-    {
-      sprintf (str, "text#%03d", i);
-      viewer->removeShape (str);
-    }
-    text_id = 0;
+    for (std::map<vtkRenderer*, boost::shared_ptr<AnnotationLayer> >::iterator it = state->annotations.begin ();
+         it != state->annotations.end (); ++it)
+      it->second->clear ();
+  }
+  else if (event.getKeySym () == "i" && event.keyDown () && state->perf)
+  {
+    state->perf->toggle ();
+    if (state->loop)
+      state->loop->wake ();
+  }
+  else if (event.getKeySym () == "k" && event.keyDown () && state->recolour && state->loader)
+    std::cout << "The colours can be switched once the file has loaded" << std::endl;
+  else if (event.getKeySym () == "k" && event.keyDown () && state->recolour)
+  {
+    // None, z, range and round again; the points drawn are uploaded anew.
+    // A range not known yet is taken from the whole cloud; a compacted
+    // cloud has them all from before it was let go.
+    state->colour_field = (state->colour_field == COLOUR_FIELD_NONE ? COLOUR_FIELD_Z :
+                           state->colour_field == COLOUR_FIELD_Z ? COLOUR_FIELD_RANGE : COLOUR_FIELD_NONE);
+    FieldRange& range = state->colour_ranges[state->colour_field];
+    if (state->colour_field != COLOUR_FIELD_NONE && !range.known)
+      range = getFieldRange (*state->cloud, state->colour_field);
+    std::cout << "Colouring by " << getColourFieldName (state->colour_field) << std::endl;
+    updateSampleCloud (*state, state->lod ? state->lod->getDisplayCloud () : state->cloud);
   }
 }
 
 void mouseEventOccurred (const pcl::visualization::MouseEvent &event,
-                         void* viewer_void)
+                         void* state_void)
 {
-  pcl::visualization::PCLVisualizer *viewer = static_cast<pcl::visualization::PCLVisualizer *> (viewer_void);
+  ViewerState *state = static_cast<ViewerState *> (state_void);
   if (event.getButton () == pcl::visualization::MouseEvent::LeftButton &&
       event.getType () == pcl::visualization::MouseEvent::MouseButtonRelease)
   {
     std::cout << "Left mouse button released at position (" << event.getX () << ", " << event.getY () << ")" << std::endl;
-
-    char str[512];
-    sprintf (str, "text#%03d", text_id ++);
-    viewer->addText ("clicked here", event.getX (), event.getY (), str);
+    std::string text = "clicked here";
+    vtkRenderer* renderer = getPokedRenderer (*state, event.getX (), event.getY ());
+    if (state->picker)
+    {
+      pcl::console::TicToc tt;
+      tt.tic ();
+      int index = pickAtPixel (*state->picker, renderer, event.getX (), event.getY ());
+      if (index >= 0)
+      {
+        text = state->picker->describe (index);
+        std::cout << "Picked " << text << " in " << tt.toc () << " ms" << std::endl;
+      }
+    }
+    getAnnotations (*state, renderer).add (text, event.getX (), event.getY ());
   }
 }
 
-boost::shared_ptr<pcl::visualization::PCLVisualizer> interactionCustomizationVis ()
+// Samples the performance numbers once a second while the overlay is shown
+// or a log is written
+int
+perfTick (ViewerState& state)
+{
+  if (!state.perf || (!state.perf->isVisible () && !state.perf->isLogging ()))
+    return (UpdateLoop::TICK_IDLE);
+  if (!state.perf->isDue ())
+    return (UpdateLoop::TICK_BUSY);
+
+  PerfSample sample = state.perf->sample (state.total_points);
+  state.perf->log (sample);
+  state.perf->show (sample);
+  return (UpdateLoop::TICK_BUSY | (state.perf->isVisible () ? UpdateLoop::TICK_REDRAW : 0));
+}
+
+// The callbacks get the whole state rather than just the viewer
+void
+enableAnnotations (ViewerState& state)
+{
+  state.annotations.clear ();
+  state.viewer->registerKeyboardCallback (keyboardEventOccurred, (void*)&state);
+  state.viewer->registerMouseCallback (mouseEventOccurred, (void*)&state);
+}
+
+boost::shared_ptr<pcl::visualization::PCLVisualizer> interactionCustomizationVis (ViewerState& state)
 {
   boost::shared_ptr<pcl::visualization::PCLVisualizer> viewer (new pcl::visualization::PCLVisualizer ("3D Viewer"));
   viewer->setBackgroundColor (0, 0, 0);
   viewer->addCoordinateSystem (1.0);
 
-  viewer->registerKeyboardCallback (keyboardEventOccurred, (void*)viewer.get ());
-  viewer->registerMouseCallback (mouseEventOccurred, (void*)viewer.get ());
+  state.viewer = viewer;
+  enableAnnotations (state);
 
   return (viewer);
 }
 
+// Moves the batches parsed so far into the viewer while --stream loads
+int
+streamTick (ViewerState& state)
+{
+  if (!state.loader)
+    return (UpdateLoop::TICK_IDLE);
+
+  // Every update re-uploads the whole cloud, so back off when that gets
+  // slower than the requested interval
+  if (state.load_time.toc () - state.last_update < std::max<double> (state.stream_ms, 2.0 * state.update_cost))
+    return (UpdateLoop::TICK_BUSY);
+
+  boost::shared_ptr<pcl::visualization::PCLVisualizer>& viewer = state.viewer;
+  StreamLoader& loader = *state.loader;
+  bool done = loader.isDone ();
+  pcl::console::TicToc tt;
+  tt.tic ();
+  if (loader.drain (*state.cloud))
+    updateSampleCloud (state, state.cloud);
+  state.update_cost = tt.toc ();
+  state.last_update = state.load_time.toc ();
+
+  if (!done)
+  {
+    std::ostringstream progress;
+    progress.precision (1);
+    progress << std::fixed << "Loading " << loader.getParsedBytes () / (1024.0 * 1024.0) << " / "
+             << loader.getTotalBytes () / (1024.0 * 1024.0) << " MB ("
+             << 100.0 * loader.getParsedBytes () / std::max<size_t> (loader.getTotalBytes (), 1) << "%), "
+             << state.cloud->points.size () << " points";
+    viewer->updateText (progress.str (), 10, 10, "progress");
+    return (UpdateLoop::TICK_BUSY | UpdateLoop::TICK_REDRAW);
+  }
+
+  std::cout << "Streamed " << state.cloud->points.size () << " points in " << state.last_update << " ms\n";
+  viewer->removeShape ("progress");
+  if (state.write_cache)
+    state.cache_writer = boost::thread (&writeCloudCache<pcl::PointXYZ>, state.filename, state.cache_key, boost::cref (*state.cloud));
+  state.loader.reset ();
+
+  if (state.force_lod || state.cloud->points.size () > state.lod_min)
+  {
+    std::vector<pcl::visualization::Camera> cameras;
+    state.lod.reset (new LodRenderer (state.cloud, state.budget));
+    viewer->getCameras (cameras);
+    state.lod->select (cameras[0]);
+    updateSampleCloud (state, state.lod->getDisplayCloud ());
+  }
+  return (UpdateLoop::TICK_REDRAW);
+}
+
+// Shows the lines appended to a --follow file. Every update becomes an actor
+// of its own, so only new points are uploaded; an update first absorbs the
+// newest actors that are not larger than it, which keeps the number of actors
+// logarithmic and uploads each point a logarithmic number of times.
+int
+followTick (ViewerState& state)
+{
+  if (!state.follower)
+    return (UpdateLoop::TICK_IDLE);
+
+  // A watched file wakes the loop when it is written to; otherwise it is
+  // looked at on every tick
+  const int more = (state.follower->isWatched () ? UpdateLoop::TICK_IDLE : UpdateLoop::TICK_BUSY);
+  pcl::PointCloud<pcl::PointXYZ>& cloud = *state.cloud;
+  size_t begin = cloud.points.size ();
+  bool truncated;
+  bool grew = state.follower->poll (cloud, truncated);
+  if (truncated)
+  {
+    for (size_t i = 0; i < state.deltas.size (); ++i)
+      state.viewer->removePointCloud (state.deltas[i].id);
+    state.deltas.clear ();
+    cloud.points.erase (cloud.points.begin (), cloud.points.begin () + begin);
+    cloud.width = static_cast<uint32_t> (cloud.points.size ());
+    updateSampleCloud (state, state.cloud);
+    return (more | UpdateLoop::TICK_REDRAW);
+  }
+  if (!grew)
+    return (more);
+
+  size_t end = cloud.points.size ();
+  while (!state.deltas.empty () && state.deltas.back ().end - state.deltas.back ().begin <= end - begin)
+  {
+    begin = state.deltas.back ().begin;
+    state.viewer->removePointCloud (state.deltas.back ().id);
+    state.deltas.pop_back ();
+  }
+  char id[64];
+  sprintf (id, "delta#%03u", state.delta_id++);
+  ViewerState::Delta delta;
+  delta.id = id;
+  delta.begin = begin;
+  delta.end = end;
+  state.deltas.push_back (delta);
+
+  pcl::PointCloud<pcl::PointXYZ>::Ptr points (new pcl::PointCloud<pcl::PointXYZ>);
+  points->points.assign (cloud.points.begin () + begin, cloud.points.begin () + end);
+  points->width = static_cast<uint32_t> (end - begin);
+  points->height = 1;
+  updateSampleCloud (state, points, delta.id);
+  return (more | UpdateLoop::TICK_REDRAW);
+}
+
+// Shows the newest frame of the --shm ring buffer. It is read into the spare
+// cloud, which then swaps places with the displayed one, so neither is
+// reallocated once they reached the frame size.
+int
+shmTick (ViewerState& state)
+{
+  if (!state.shm)
+    return (UpdateLoop::TICK_IDLE);
+  if (!state.shm->readLatest (*state.spare))
+    return (UpdateLoop::TICK_BUSY);
+
+  state.cloud.swap (state.spare);
+  updateSampleCloud (state, state.cloud);
+  if (state.shm_frames++ == 0)
+    state.viewer->resetCamera ();
+  std::ostringstream status;
+  status << "Frame " << state.shm_frames << ", " << state.cloud->points.size () << " points, "
+         << state.shm->getDroppedFrames () << " dropped";
+  state.viewer->updateText (status.str (), 10, 10, "shm");
+  return (UpdateLoop::TICK_BUSY | UpdateLoop::TICK_REDRAW);
+}
+
+// Reselects the octree's subset once the camera held still after a move
+int
+lodTick (ViewerState& state)
+{
+  if (!state.lod)
+    return (UpdateLoop::TICK_IDLE);
+
+  std::vector<pcl::visualization::Camera> cameras;
+  state.viewer->getCameras (cameras);
+  int flags = UpdateLoop::TICK_IDLE;
+  if (state.lod->update (cameras[0]))
+  {
+    updateSampleCloud (state, state.lod->getDisplayCloud ());
+    flags |= UpdateLoop::TICK_REDRAW;
+  }
+  if (state.lod->isWaiting ())
+    flags |= UpdateLoop::TICK_BUSY;
+  return (flags);
+}
+
+// ---------------------------------------------------
+// -----Live frames from a shared memory producer-----
+// ---------------------------------------------------
+// The timer keeps polling while the window is open: the producer may not have
+// started yet, and between frames there is nothing to wait on.
+int
+viewSharedMemory (const std::string& name, bool custom_colour, const std::string& perf_log)
+{
+  ViewerState state;
+  state.cloud.reset (new pcl::PointCloud<pcl::PointXYZ>);
+  state.spare.reset (new pcl::PointCloud<pcl::PointXYZ>);
+  state.shm.reset (new ShmCloudReader (name));
+  state.custom_colour = custom_colour;
+  state.viewer = (custom_colour ? customColourVis (state.cloud) : simpleVis (state.cloud));
+  state.viewer->addText ("Waiting for " + name + "...", 10, 10, "shm");
+  enableAnnotations (state);
+  state.perf.reset (new PerfMonitor (state.viewer));
+  if (!perf_log.empty ())
+    state.perf->openLog (perf_log);
+
+  UpdateLoop loop (state.viewer);
+  state.loop = &loop;
+  loop.addTicker (boost::bind (&shmTick, boost::ref (state)));
+  loop.addTicker (boost::bind (&perfTick, boost::ref (state)));
+  loop.run ();
+  return (0);
+}
+
+// ------------------------------------------------
+// -----Several files side by side, one window-----
+// ------------------------------------------------
+template <typename PointT> int
+viewGrid (const std::vector<std::string>& filenames, bool use_cache, bool custom_colour,
+          const std::vector<FilterStage>& filters, const std::string& perf_log)
+{
+  std::vector<typename pcl::PointCloud<PointT>::Ptr> clouds;
+  if (!loadPointFiles<PointT> (filenames, use_cache, filters, clouds))
+    return (-1);
+
+  ViewerState state;
+  state.viewer = gridVis<PointT> (clouds, filenames, custom_colour);
+  state.custom_colour = custom_colour;
+  enableAnnotations (state);
+  state.perf.reset (new PerfMonitor (state.viewer));
+  if (!perf_log.empty ())
+    state.perf->openLog (perf_log);
+
+  UpdateLoop loop (state.viewer);
+  state.loop = &loop;
+  loop.addTicker (boost::bind (&perfTick, boost::ref (state)));
+  loop.run ();
+  return (0);
+}
+
 // --------------
 // -----Main-----
 // --------------
@@ -231,34 +818,576 @@ main (int argc, char** argv)
   bool simple(false), rgb(false), custom_c(false), normals(false),
     shapes(false), viewports(false), interaction_customization(false);
 
-  if (pcl::console::find_argument (argc, argv, "-f") >= 0)
+  std::string perf_log;
+  pcl::console::parse_argument (argc, argv, "--perf-log", perf_log);
+  std::string shm_name;
+  if (pcl::console::parse_argument (argc, argv, "--shm", shm_name) >= 0)
+    return (viewSharedMemory (shm_name, pcl::console::find_switch (argc, argv, "-c"), perf_log));
+
+  // More than one -f opens a grid of viewports, with the files loaded in
+  // parallel. Colour or intensity is shown if every file has it.
+  std::vector<std::string> filenames;
+  if (pcl::console::parse_multiple_arguments (argc, argv, "-f", filenames) >= 0 && filenames.size () > 1)
   {
-    std::cout << "Reading point cloud information: \n" << argv[2] << "\n";
+    // The grid shows the files as loaded (and filtered) and nothing else
+    const char* single[] = { "--bench", "--render", "--render-depth", "--depth-unit", "--diff", "-n", "--ooc", "--follow",
+                             "--compact", "--colour-by", "--stream", "--lod", "--batch" };
+    for (size_t i = 0; i < sizeof (single) / sizeof (single[0]); ++i)
+      if (pcl::console::find_argument (argc, argv, single[i]) >= 0)
+      {
+        std::cerr << single[i] << " works on a single -f file and cannot be used with a grid of several" << std::endl;
+        return (-1);
+      }
+    bool use_cache = !pcl::console::find_switch (argc, argv, "--no-cache");
+    bool custom_colour = pcl::console::find_switch (argc, argv, "-c");
+    std::string pipeline;
+    std::vector<FilterStage> filters;
+    if (pcl::console::parse_argument (argc, argv, "--pipeline", pipeline) >= 0 && !parseFilterPipeline (pipeline, filters))
+      return (-1);
+    bool all_rgb = true, all_intensity = true;
+    for (size_t i = 0; i < filenames.size (); ++i)
+    {
+      PointFileFormat format = detectPointFileFormat (filenames[i]);
+      int columns = (format == POINT_FILE_TEXT ? detectColumns (filenames[i]) : 3);
+      all_rgb = all_rgb && (columns >= 6 || (format != POINT_FILE_TEXT && hasBinaryColour (filenames[i], format)));
+      all_intensity = all_intensity && (columns == 4 || columns == 5);
+    }
+    if (all_rgb)
+      return (viewGrid<pcl::PointXYZRGB> (filenames, use_cache, custom_colour, filters, perf_log));
+    if (all_intensity)
+      return (viewGrid<pcl::PointXYZI> (filenames, use_cache, custom_colour, filters, perf_log));
+    return (viewGrid<pcl::PointXYZ> (filenames, use_cache, custom_colour, filters, perf_log));
+  }
+
+  std::string batch_dir;
+  if (pcl::console::parse_argument (argc, argv, "--batch", batch_dir) >= 0)
+  {
+    BatchOptions options;
+    options.directory = batch_dir;
+    options.workers = 0;
+    options.use_cache = !pcl::console::find_switch (argc, argv, "--no-cache");
+    options.snapshot_width = 1280;
+    options.snapshot_height = 960;
+    options.splat_size = 0.0f;
+    pcl::console::parse_argument (argc, argv, "--batch-out", options.stats_file);
+    pcl::console::parse_argument (argc, argv, "--snapshots", options.snapshot_dir);
+    pcl::console::parse_argument (argc, argv, "--workers", options.workers);
+    pcl::console::parse_2x_arguments (argc, argv, "--render-size", options.snapshot_width, options.snapshot_height);
+    pcl::console::parse_argument (argc, argv, "--splat-size", options.splat_size);
+    std::string pipeline;
+    if (pcl::console::parse_argument (argc, argv, "--pipeline", pipeline) >= 0 && !parseFilterPipeline (pipeline, options.filters))
+      return (-1);
+    if (options.snapshot_width <= 0 || options.snapshot_height <= 0 || options.snapshot_width > 32767 ||
+        options.snapshot_height > 32767)
+    {
+      std::cerr << "--render-size takes a width and height between 1 and 32767" << std::endl;
+      return (-1);
+    }
+    std::vector<std::string> files;
+    if (!listBatchInputs (batch_dir, files))
+      return (-1);
+    boost::system::error_code ec;
+    if (!options.snapshot_dir.empty ())
+      boost::filesystem::create_directories (options.snapshot_dir, ec);
+    if (ec)
+    {
+      std::cerr << "Cannot create " << options.snapshot_dir << ": " << ec.message () << std::endl;
+      return (-1);
+    }
+    return (BatchRunner (options, files).run ());
+  }
+
+  std::string filename;
+  if (pcl::console::parse_argument (argc, argv, "-f", filename) >= 0)
+  {
+    std::cout << "Reading point cloud information: \n" << filename << "\n";
 
     // ---------------------------------
     // ----- Read point cloud data -----
     // ---------------------------------
     pcl::PointCloud<pcl::PointXYZ>::Ptr basic_cloud_ptr(new pcl::PointCloud<pcl::PointXYZ>);
-    float x, y, z;
+    pcl::PointCloud<pcl::PointXYZRGB>::Ptr rgb_cloud_ptr(new pcl::PointCloud<pcl::PointXYZRGB>);
+    pcl::PointCloud<pcl::PointXYZI>::Ptr intensity_cloud_ptr(new pcl::PointCloud<pcl::PointXYZI>);
+    bool use_cache = !pcl::console::find_switch (argc, argv, "--no-cache");
+    bool stream = pcl::console::find_switch (argc, argv, "--stream");
+    int stream_ms = 250;
+    pcl::console::parse_argument (argc, argv, "--stream-ms", stream_ms);
+    int lod_min = 50000000, budget = 2000000;
+    pcl::console::parse_argument (argc, argv, "--lod-min", lod_min);
+    pcl::console::parse_argument (argc, argv, "--budget", budget);
+    bool force_lod = pcl::console::find_switch (argc, argv, "--lod");
+    bool out_of_core = pcl::console::find_switch (argc, argv, "--ooc");
+    int mem_budget = 1024;
+    pcl::console::parse_argument (argc, argv, "--mem-budget", mem_budget);
+    bool follow = pcl::console::find_switch (argc, argv, "--follow");
+    bool bench = pcl::console::find_switch (argc, argv, "--bench");
+    std::string bench_out;
+    pcl::console::parse_argument (argc, argv, "--bench-out", bench_out);
+    std::vector<double> normal_radii;
+    normals = pcl::console::parse_x_arguments (argc, argv, "-n", normal_radii) >= 0 && !normal_radii.empty ();
+    for (size_t i = 0; i < normal_radii.size (); ++i)
+      if (!(normal_radii[i] > 0.0) || !pcl_isfinite (normal_radii[i]))
+      {
+        std::cerr << "-n takes search radii greater than 0, e.g. 0.01,0.1" << std::endl;
+        return (-1);
+      }
+    custom_c = pcl::console::find_switch (argc, argv, "-c");
+    std::string colour_by;
+    ColourField colour_field = COLOUR_FIELD_NONE;
+    if (pcl::console::parse_argument (argc, argv, "--colour-by", colour_by) >= 0 && !parseColourField (colour_by, colour_field))
+      return (-1);
+    std::string pipeline;
+    std::vector<FilterStage> filters;
+    if (pcl::console::parse_argument (argc, argv, "--pipeline", pipeline) >= 0 && !parseFilterPipeline (pipeline, filters))
+      return (-1);
+    std::string render_colour, render_depth;
+    pcl::console::parse_argument (argc, argv, "--render", render_colour);
+    pcl::console::parse_argument (argc, argv, "--render-depth", render_depth);
+    float depth_unit = 0.001f;
+    pcl::console::parse_argument (argc, argv, "--depth-unit", depth_unit);
+    bool render = !render_colour.empty () || !render_depth.empty ();
+    int render_width = 1280, render_height = 960;
+    pcl::console::parse_2x_arguments (argc, argv, "--render-size", render_width, render_height);
+    float splat_size = 0.0f;
+    pcl::console::parse_argument (argc, argv, "--splat-size", splat_size);
+    std::string diff_reference;
+    bool diff = pcl::console::parse_argument (argc, argv, "--diff", diff_reference) >= 0;
+    float diff_max = 0.0f;
+    pcl::console::parse_argument (argc, argv, "--diff-max", diff_max);
+    float compact_precision = 0.0f;
+    bool compact = pcl::console::parse_argument (argc, argv, "--compact", compact_precision) >= 0;
+    if (compact && !(compact_precision > 0.0f))
+    {
+      std::cerr << "--compact takes the largest distance a point may move, greater than 0" << std::endl;
+      return (-1);
+    }
+    if (bench || normals || follow || render || diff || compact || colour_field != COLOUR_FIELD_NONE || !filters.empty ())
+      stream = false;
+    PointFileFormat format = detectPointFileFormat (filename);
+    if (stream && (format != POINT_FILE_TEXT || detectCompression (filename) != COMPRESSION_NONE))
+    {
+      std::cout << "Binary and compressed input is loaded in full; --stream is ignored\n";
+      stream = false;
+    }
+    if (out_of_core && format != POINT_FILE_TEXT)
+    {
+      std::cerr << "--ooc reads text input only" << std::endl;
+      return (-1);
+    }
+    if (follow && (out_of_core || format != POINT_FILE_TEXT || detectCompression (filename) != COMPRESSION_NONE))
+    {
+      std::cerr << "--follow reads uncompressed text input only and cannot be used with --ooc" << std::endl;
+      return (-1);
+    }
+    if (diff && (out_of_core || follow || normals || render))
+    {
+      std::cerr << "--diff shows its distances in the viewer and cannot be used with --ooc, --follow, -n or --render"
+                << std::endl;
+      return (-1);
+    }
+    if (normals && out_of_core)
+    {
+      std::cerr << "-n needs the whole cloud in memory and cannot be used with --ooc" << std::endl;
+      return (-1);
+    }
+    if (!filters.empty () && (out_of_core || follow))
+    {
+      std::cerr << "--pipeline filters a cloud loaded in full and cannot be used with --ooc or --follow" << std::endl;
+      return (-1);
+    }
+    if (render && (out_of_core || follow || bench))
+    {
+      std::cerr << "--render draws a cloud loaded in full and cannot be used with --ooc, --follow or --bench" << std::endl;
+      return (-1);
+    }
+    if (!(depth_unit > 0.0f))
+    {
+      std::cerr << "--depth-unit takes the depth of one step, greater than 0" << std::endl;
+      return (-1);
+    }
+    if (render && (render_width <= 0 || render_height <= 0 || render_width > 32767 || render_height > 32767))
+    {
+      std::cerr << "--render-size takes a width and height between 1 and 32767" << std::endl;
+      return (-1);
+    }
+
+    // Four and five column files carry intensity, six and more colour, and
+    // so do PLY and LAS files with RGB fields. Those load in full; streaming,
+    // paging, normals and --diff read X Y Z only.
+    int columns = (format == POINT_FILE_TEXT ? detectColumns (filename) : 3);
+    rgb = (columns >= 6 || (format != POINT_FILE_TEXT && hasBinaryColour (filename, format)));
+    bool intensity = (columns == 4 || columns == 5);
+    if ((rgb || intensity) && (stream || out_of_core || normals || follow || diff))
+    {
+      std::cout << "Reading X Y Z only; the other columns are not used with --stream, --ooc, --follow, -n or --diff\n";
+      rgb = intensity = false;
+    }
+    if (colour_field != COLOUR_FIELD_NONE && (rgb || diff || normals || follow))
+    {
+      std::cout << "--colour-by is ignored with colour input, --diff, -n and --follow\n";
+      colour_field = COLOUR_FIELD_NONE;
+    }
+    if (colour_field == COLOUR_FIELD_INTENSITY && !intensity)
+    {
+      std::cerr << "--colour-by intensity needs X Y Z I text input loaded in full" << std::endl;
+      return (-1);
+    }
+    if (compact && (out_of_core || follow || normals || diff || render || rgb || intensity))
+    {
+      std::cout << "--compact only stores the octree of an XYZ cloud; it is ignored with --ooc, --follow, -n, --diff,"
+                << " --render and colour or intensity input\n";
+      compact = false;
+    }
+
+    BenchReport report;
+    boost::system::error_code ec;
+    size_t file_bytes = static_cast<size_t> (boost::filesystem::file_size (filename, ec));
+    pcl::console::TicToc stage;
+
+    boost::shared_ptr<StreamLoader> loader;
+    boost::shared_ptr<FileFollower> follower;
+    BudgetRenderer::Ptr lod;
+    CloudCacheKey cache_key;
+    bool write_cache = false;
+    size_t total_points = 0;
+    FieldRange colour_ranges[COLOUR_FIELD_COUNT];
+    stage.tic ();
+    if (out_of_core)
+    {
+      // The cloud itself is never loaded; only pages near the camera are
+      boost::shared_ptr<PagedRenderer> paged (new PagedRenderer (static_cast<size_t> (mem_budget) << 20, budget));
+      if (!paged->open (filename))
+        return (-1);
+      lod = paged;
+      total_points = paged->getPointCount ();
+      // Colours go by the bounds of the leaves, as no page holds them all
+      float min_pt[3], max_pt[3];
+      if (paged->getBounds (min_pt, max_pt))
+        for (int field = COLOUR_FIELD_Z; field <= COLOUR_FIELD_RANGE; ++field)
+          colour_ranges[field] = getBoxFieldRange (min_pt, max_pt, static_cast<ColourField> (field));
+      report.addStage ("ooc_open", stage.toc (), total_points, file_bytes);
+    }
+    else if (stream)
+    {
+      // A valid sidecar loads faster than the first batch would parse
+      write_cache = use_cache && getCacheKey (filename, cache_key);
+      if (!write_cache || !readCloudCache (filename, cache_key, *basic_cloud_ptr))
+      {
+        loader.reset (new StreamLoader);
+        if (!loader->start (filename))
+          return (-1);
+      }
+    }
+    else if (follow)
+    {
+      // Everything up to the last complete line now, the rest as it is written
+      bool truncated;
+      follower.reset (new FileFollower (filename));
+      follower->poll (*basic_cloud_ptr, truncated);
+      total_points = basic_cloud_ptr->points.size ();
+      report.addStage ("load", stage.toc (), total_points, file_bytes);
+    }
+    else if (rgb)
+    {
+      if (!loadPointFile (filename, *rgb_cloud_ptr, use_cache))
+        return (-1);
+      total_points = rgb_cloud_ptr->points.size ();
+      report.addStage ("load", stage.toc (), total_points, file_bytes);
+    }
+    else if (intensity)
+    {
+      if (!loadPointFile (filename, *intensity_cloud_ptr, use_cache))
+        return (-1);
+      total_points = intensity_cloud_ptr->points.size ();
+      report.addStage ("load", stage.toc (), total_points, file_bytes);
+    }
+    else
+    {
+      if (!loadPointFile (filename, *basic_cloud_ptr, use_cache))
+        return (-1);
+      total_points = basic_cloud_ptr->points.size ();
+      report.addStage ("load", stage.toc (), total_points, file_bytes);
+    }
+
+    // Filters run in the cloud's own point type, before anything is built
+    // on top of it
+    if (!filters.empty ())
+    {
+      bool filtered;
+      if (rgb)
+        filtered = runFilterPipeline<pcl::PointXYZRGB> (filters, rgb_cloud_ptr, report);
+      else if (intensity)
+        filtered = runFilterPipeline<pcl::PointXYZI> (filters, intensity_cloud_ptr, report);
+      else
+        filtered = runFilterPipeline<pcl::PointXYZ> (filters, basic_cloud_ptr, report);
+      if (!filtered)
+        return (-1);
+    }
+
+    // ---------------------------------------------
+    // -----Headless thumbnail: no PCLVisualizer-----
+    // ---------------------------------------------
+    // The camera looks the way the viewer's would after resetCamera, and the
+    // cloud is splatted on the CPU, so no GPU or display is needed
+    if (render)
+    {
+      Eigen::Vector4f min_pt, max_pt;
+      if (rgb)
+        pcl::getMinMax3D (*rgb_cloud_ptr, min_pt, max_pt);
+      else if (intensity)
+        pcl::getMinMax3D (*intensity_cloud_ptr, min_pt, max_pt);
+      else
+        pcl::getMinMax3D (*basic_cloud_ptr, min_pt, max_pt);
+      pcl::visualization::Camera camera = getDefaultCamera (render_width, render_height);
+      fitCamera (camera, min_pt.head<3> (), max_pt.head<3> ());
+      SplatRenderer splatter (camera, splat_size);
+      stage.tic ();
+      if (rgb)
+        splatter.render (*rgb_cloud_ptr);
+      else if (intensity)
+        splatter.render (*intensity_cloud_ptr);
+      else
+        splatter.render (*basic_cloud_ptr);
+      bool saved = true;
+      if (!render_colour.empty ())
+        saved = splatter.saveColour (render_colour) && saved;
+      if (!render_depth.empty ())
+        saved = splatter.saveDepth (render_depth, depth_unit) && saved;
+      std::cout << "Rendered " << render_width << "x" << render_height << " in " << stage.toc () << " ms\n";
+      return (saved ? 0 : -1);
+    }
 
-    ifstream datafile(argv[2]);
-    while (datafile >> x >> y >> z)
+    // The tree is built once and handed to the estimator, which keeps it
+    // because its input is already this cloud. Several radii share a single
+    // search at the largest one.
+    std::vector<pcl::PointCloud<pcl::Normal>::Ptr> cloud_normals;
+    if (normals)
     {
-        pcl::PointXYZ basic_point;
-        basic_point.x = x;
-        basic_point.y = y;
-        basic_point.z = z;
-        basic_cloud_ptr->points.push_back(basic_point);
+      stage.tic ();
+      pcl::search::KdTree<pcl::PointXYZ>::Ptr tree = buildSearchTree (basic_cloud_ptr);
+      report.addStage ("kdtree_build", stage.toc (), total_points, 0);
+      stage.tic ();
+      if (normal_radii.size () == 1)
+        cloud_normals.push_back (estimateNormals (basic_cloud_ptr, tree, normal_radii[0]));
+      else
+        cloud_normals = estimateMultiScaleNormals (basic_cloud_ptr, tree, normal_radii);
+      report.addStage ("normals", stage.toc (), total_points, 0);
+    }
+
+    // Every loaded point gets the distance to its nearest neighbour in the
+    // reference, which is loaded, filtered by nothing, as XYZ
+    boost::shared_ptr<std::vector<float> > distances;
+    if (diff)
+    {
+      pcl::PointCloud<pcl::PointXYZ> reference;
+      stage.tic ();
+      if (!loadPointFile (diff_reference, reference, use_cache))
+        return (-1);
+      report.addStage ("diff_load", stage.toc (), reference.points.size (), 0);
+      stage.tic ();
+      ReferenceForest forest (reference);
+      report.addStage ("diff_kdtree_build", stage.toc (), reference.points.size (), 0);
+      stage.tic ();
+      distances.reset (new std::vector<float>);
+      computeCloudDistances (*basic_cloud_ptr, forest, *distances);
+      report.addStage ("diff_search", stage.toc (), basic_cloud_ptr->points.size (), 0);
+      float percentile = summariseDistances (*distances);
+      if (!(diff_max > 0))
+        diff_max = percentile;
+    }
+
+    // Colours are stretched over the whole cloud, worked out before the
+    // octree or --compact take it over
+    if (colour_field != COLOUR_FIELD_NONE && !colour_ranges[colour_field].known)
+    {
+      stage.tic ();
+      if (intensity)
+        colour_ranges[colour_field] = getFieldRange (*intensity_cloud_ptr, colour_field);
+      else
+        colour_ranges[colour_field] = getFieldRange (*basic_cloud_ptr, colour_field);
+      report.addStage ("colour_range", stage.toc (), total_points, 0);
+    }
+
+    // Large clouds are drawn through the octree, which keeps a budget-sized
+    // subset in view; the camera from simpleVis decides the first subset.
+    // Normals are drawn for the whole cloud, so they bypass it, and so do
+    // colour, intensity and distances, which it does not carry, and a
+    // followed file. With --compact the octree quantises its leaves and the
+    // float cloud is let go; from then on the octree is the only copy.
+    const size_t cloud_points = basic_cloud_ptr->points.size ();
+    boost::shared_ptr<LodRenderer> compacted;
+    if (!lod && !loader && !follower && !normals && !diff && !rgb && !intensity &&
+        (force_lod || compact || cloud_points > static_cast<size_t> (lod_min)))
+    {
+      stage.tic ();
+      boost::shared_ptr<LodRenderer> tree (new LodRenderer (basic_cloud_ptr, budget));
+      lod = tree;
+      report.addStage ("lod_build", stage.toc (), total_points, 0);
+      if (compact)
+      {
+        stage.tic ();
+        if (tree->compact (compact_precision))
+        {
+          report.addStage ("compact", stage.toc (), cloud_points, tree->getOctree ().getCompactCloud ().getMemoryBytes ());
+          compacted = tree;
+          for (int field = COLOUR_FIELD_Z; field <= COLOUR_FIELD_RANGE; ++field)
+            if (!colour_ranges[field].known)
+              colour_ranges[field] = getFieldRange (*basic_cloud_ptr, static_cast<ColourField> (field));
+          basic_cloud_ptr.reset (new pcl::PointCloud<pcl::PointXYZ>);
+        }
+        else
+          std::cout << "An octree leaf is more than 2^21 steps of " << 2.0f * compact_precision
+                    << " across; the cloud is kept at full precision\n";
+      }
+    }
+
+    // Clicks pick from the whole cloud as loaded. Streamed and followed
+    // clouds keep changing and a paged one is never in memory, so those
+    // only get the click position.
+    PointPicker::Ptr picker;
+    if (!bench && !out_of_core && !loader && !follower)
+    {
+      if (rgb)
+        picker.reset (new OctreePicker<pcl::PointXYZRGB> (rgb_cloud_ptr));
+      else if (intensity)
+        picker.reset (new OctreePicker<pcl::PointXYZI> (intensity_cloud_ptr));
+      else if (compacted)
+        picker.reset (new LodPicker (compacted));
+      else
+        picker.reset (new OctreePicker<pcl::PointXYZ> (basic_cloud_ptr));
+    }
+
+    // -------------------------------------------------
+    // -----Headless benchmark: no PCLVisualizer-----
+    // -------------------------------------------------
+    if (bench)
+    {
+      pcl::visualization::Camera camera = getDefaultCamera (1280, 960);
+      pcl::PointCloud<pcl::PointXYZ>::Ptr display = basic_cloud_ptr;
+      if (lod)
+      {
+        stage.tic ();
+        lod->select (camera);
+        display = lod->getDisplayCloud ();
+        report.addStage ("lod_select", stage.toc (), display->points.size (), 0);
+      }
+      if (colour_field != COLOUR_FIELD_NONE)
+      {
+        // The colours addPointCloud would upload
+        stage.tic ();
+        vtkSmartPointer<vtkDataArray> colours;
+        size_t coloured = (intensity ? intensity_cloud_ptr->points.size () : display->points.size ());
+        if (intensity)
+          PointCloudColorHandlerField<pcl::PointXYZI> (intensity_cloud_ptr, colour_field, colour_ranges[colour_field]).getColor (colours);
+        else
+          PointCloudColorHandlerField<pcl::PointXYZ> (display, colour_field, colour_ranges[colour_field]).getColor (colours);
+        report.addStage ("colour_map", stage.toc (), coloured, coloured * 3);
+      }
+      double frame_ms;
+      bool rendered;
+      size_t drawn = display->points.size ();
+      if (rgb)
+      {
+        rendered = renderOffscreenFrame (*rgb_cloud_ptr, camera, frame_ms);
+        drawn = rgb_cloud_ptr->points.size ();
+      }
+      else if (intensity)
+      {
+        rendered = renderOffscreenFrame (*intensity_cloud_ptr, camera, frame_ms);
+        drawn = intensity_cloud_ptr->points.size ();
+      }
+      else
+        rendered = renderOffscreenFrame (*display, camera, frame_ms);
+      if (rendered)
+        report.addStage ("first_frame", frame_ms, drawn, drawn * 3 * sizeof (float));
+      else
+        report.skipStage ("first_frame", "no display for offscreen rendering");
+
+      if (bench_out.empty ())
+        report.writeJSON (std::cout, filename, total_points);
+      else
+      {
+        std::ofstream out (bench_out.c_str (), std::ios::app);
+        report.writeJSON (out, filename, total_points);
+      }
+      return (0);
     }
 
     boost::shared_ptr<pcl::visualization::PCLVisualizer> viewer;
-    viewer = simpleVis(basic_cloud_ptr);
+    if (rgb)
+      viewer = rgbVis (rgb_cloud_ptr);
+    else if (intensity && colour_field != COLOUR_FIELD_NONE)
+      viewer = fieldVis<pcl::PointXYZI> (intensity_cloud_ptr, colour_field, colour_ranges[colour_field]);
+    else if (intensity)
+      viewer = intensityVis (intensity_cloud_ptr);
+    else if (diff)
+      viewer = diffVis (basic_cloud_ptr, distances, diff_max, diff_reference);
+    else if (normals && cloud_normals.size () == 1)
+      viewer = normalsVis (makeColourCloud (*basic_cloud_ptr, 255, 255, 255), cloud_normals[0]);
+    else if (normals)
+      viewer = viewportsVis (makeColourCloud (*basic_cloud_ptr, 255, 255, 255), cloud_normals, normal_radii);
+    else if (colour_field != COLOUR_FIELD_NONE)
+      viewer = fieldVis<pcl::PointXYZ> (lod ? lod->getDisplayCloud () : basic_cloud_ptr, colour_field,
+                                        colour_ranges[colour_field]);
+    else if (custom_c)
+      viewer = customColourVis (lod ? lod->getDisplayCloud () : basic_cloud_ptr);
+    else
+      viewer = simpleVis(lod ? lod->getDisplayCloud () : basic_cloud_ptr);
+    if (loader)
+      viewer->addText ("Loading...", 10, 10, "progress");
+
+    // Input is handled as it arrives; the tickers only run on a timer while
+    // the file is streaming or the camera has just moved
+    ViewerState state;
+    state.viewer = viewer;
+    state.cloud = basic_cloud_ptr;
+    state.loader = loader;
+    state.lod = lod;
+    state.filename = filename;
+    state.cache_key = cache_key;
+    state.write_cache = write_cache;
+    state.force_lod = force_lod;
+    state.lod_min = static_cast<size_t> (lod_min);
+    state.budget = static_cast<size_t> (budget);
+    state.stream_ms = stream_ms;
+    state.custom_colour = custom_c;
+    state.colour_field = colour_field;
+    std::copy (colour_ranges, colour_ranges + COLOUR_FIELD_COUNT, state.colour_ranges);
+    state.recolour = (!rgb && !intensity && !diff && !normals && !follower);
+    state.follower = follower;
+    state.picker = picker;
+    state.load_time.tic ();
+    state.total_points = (lod ? (out_of_core ? total_points : cloud_points) : 0);
+    enableAnnotations (state);
+    state.perf.reset (new PerfMonitor (viewer));
+    if (!perf_log.empty ())
+      state.perf->openLog (perf_log);
+    if (lod)
+    {
+      std::vector<pcl::visualization::Camera> cameras;
+      viewer->getCameras (cameras);
+      lod->select (cameras[0]);
+      updateSampleCloud (state, lod->getDisplayCloud ());
+    }
+    loader.reset ();
+    lod.reset ();
 
-    while (!viewer->wasStopped ())
+    UpdateLoop loop (viewer);
+    state.loop = &loop;
+    loop.addTicker (boost::bind (&streamTick, boost::ref (state)));
+    loop.addTicker (boost::bind (&lodTick, boost::ref (state)));
+    loop.addTicker (boost::bind (&followTick, boost::ref (state)));
+    loop.addTicker (boost::bind (&perfTick, boost::ref (state)));
+    if (follower && follower->isWatched ())
     {
-      viewer->spinOnce (100);
-      boost::this_thread::sleep (boost::posix_time::microseconds (100000));
+      follower->startWatching ();
+      loop.addCheck (boost::bind (&FileFollower::isPending, follower.get ()));
     }
+    loop.run ();
+    if (follower)
+      follower->stopWatching ();
+    if (state.cache_writer.joinable ())
+      state.cache_writer.join ();
   }
   else
   {
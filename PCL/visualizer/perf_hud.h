@@ -0,0 +1,213 @@
+/* Frame timing, points drawn, upload volume and memory of the running viewer,   */
+/* shown as an overlay and optionally appended to a JSON log once a second       */
+
+#ifndef PCL_VISUALIZER_PERF_HUD_H_
+#define PCL_VISUALIZER_PERF_HUD_H_
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <pcl/common/time.h>
+#include <pcl/visualization/pcl_visualizer.h>
+
+#include <vtkCallbackCommand.h>
+#include <vtkCommand.h>
+#include <vtkDataSet.h>
+#include <vtkLODActor.h>
+#include <vtkMapper.h>
+#include <vtkRenderWindow.h>
+#include <vtkSmartPointer.h>
+
+#include "bench.h"
+
+// What an updated XYZ cloud hands to VTK per point: the float coordinates,
+// three colour bytes and the two ids of its vertex cell. The GPU copy is not
+// visible from here, so this is what the upload is estimated by.
+static const size_t UPLOAD_BYTES_PER_POINT = 3 * sizeof (float) + 3 + 2 * sizeof (vtkIdType);
+
+struct PerfSample
+{
+  double time;                // seconds since the monitor started
+  double fps;
+  double frame_ms[3];         // 50th, 95th and 99th percentile render time
+  size_t frames;
+  size_t drawn, total;
+  size_t upload_bytes;        // since the previous sample
+  double upload_bytes_per_s;
+  size_t rss;
+};
+
+
+class PerfMonitor
+{
+  public:
+    PerfMonitor (const boost::shared_ptr<pcl::visualization::PCLVisualizer>& viewer) :
+      viewer_ (viewer), window_ (viewer->getRenderWindow ()), text_ ("Measuring..."), start_time_ (pcl::getTime ()),
+      frame_start_ (0.0), last_sample_ (start_time_), upload_bytes_ (0), start_tag_ (0), end_tag_ (0), visible_ (false)
+    {
+      if (!window_)
+        return;
+      callback_ = vtkSmartPointer<vtkCallbackCommand>::New ();
+      callback_->SetCallback (&PerfMonitor::onRender);
+      callback_->SetClientData (this);
+      start_tag_ = window_->AddObserver (vtkCommand::StartEvent, callback_);
+      end_tag_ = window_->AddObserver (vtkCommand::EndEvent, callback_);
+    }
+
+    ~PerfMonitor ()
+    {
+      if (window_)
+      {
+        window_->RemoveObserver (start_tag_);
+        window_->RemoveObserver (end_tag_);
+      }
+    }
+
+    bool
+    openLog (const std::string& filename)
+    {
+      log_.open (filename.c_str (), std::ios::app);
+      if (!log_)
+        std::cerr << "Cannot open " << filename << " for the performance log" << std::endl;
+      return (log_.good ());
+    }
+
+    bool
+    isLogging () const
+    {
+      return (log_.is_open ());
+    }
+
+    void
+    addUpload (size_t points)
+    {
+      upload_bytes_ += points * UPLOAD_BYTES_PER_POINT;
+    }
+
+    bool
+    isVisible () const
+    {
+      return (visible_);
+    }
+
+    void
+    toggle ()
+    {
+      visible_ = !visible_;
+      if (visible_)
+        viewer_->addText (text_, 10, 40, "perf hud");
+      else
+        viewer_->removeShape ("perf hud");
+    }
+
+    // Whether a second has passed since the last sample
+    bool
+    isDue () const
+    {
+      return (pcl::getTime () - last_sample_ >= 1.0);
+    }
+
+    // Takes the numbers over the frames of the last second. total is the
+    // size of the whole cloud where only part of it is drawn, or 0.
+    PerfSample
+    sample (size_t total)
+    {
+      PerfSample s;
+      double now = pcl::getTime ();
+      double elapsed = std::max (now - last_sample_, 1e-6);
+      s.time = now - start_time_;
+      s.frames = frame_ms_.size ();
+      s.fps = s.frames / elapsed;
+      std::vector<double> sorted (frame_ms_);
+      std::sort (sorted.begin (), sorted.end ());
+      const double quantiles[3] = { 0.5, 0.95, 0.99 };
+      for (int i = 0; i < 3; ++i)
+        s.frame_ms[i] = (sorted.empty () ? 0.0 : sorted[std::min (sorted.size () - 1, static_cast<size_t> (quantiles[i] * sorted.size ()))]);
+      s.drawn = countDrawnPoints ();
+      s.total = std::max (total, s.drawn);
+      s.upload_bytes = upload_bytes_;
+      s.upload_bytes_per_s = upload_bytes_ / elapsed;
+      s.rss = getCurrentRSS ();
+
+      frame_ms_.clear ();
+      upload_bytes_ = 0;
+      last_sample_ = now;
+      return (s);
+    }
+
+    // Updates the overlay text; it is drawn on the next render
+    void
+    show (const PerfSample& s)
+    {
+      char text[512];
+      sprintf (text, "%.1f fps, %u frames\nrender ms p50 %.2f  p95 %.2f  p99 %.2f\npoints %lu of %lu\n"
+               "upload %.1f MB/s\nRSS %.0f MB",
+               s.fps, static_cast<unsigned int> (s.frames), s.frame_ms[0], s.frame_ms[1], s.frame_ms[2],
+               static_cast<unsigned long> (s.drawn), static_cast<unsigned long> (s.total),
+               s.upload_bytes_per_s / (1 << 20), s.rss / static_cast<double> (1 << 20));
+      text_ = text;
+      if (visible_)
+        viewer_->updateText (text_, 10, 40, "perf hud");
+    }
+
+    // One line of JSON per sample
+    void
+    log (const PerfSample& s)
+    {
+      if (!log_.is_open ())
+        return;
+      log_ << "{\"time\":" << s.time << ",\"fps\":" << s.fps << ",\"frames\":" << s.frames
+           << ",\"frame_ms_p50\":" << s.frame_ms[0] << ",\"frame_ms_p95\":" << s.frame_ms[1]
+           << ",\"frame_ms_p99\":" << s.frame_ms[2] << ",\"points_drawn\":" << s.drawn
+           << ",\"points_total\":" << s.total << ",\"upload_bytes\":" << s.upload_bytes
+           << ",\"upload_bytes_per_s\":" << s.upload_bytes_per_s << ",\"rss_bytes\":" << s.rss << "}\n";
+      log_.flush ();
+    }
+
+  private:
+    // Points of the visible cloud actors, normals and other shapes aside
+    size_t
+    countDrawnPoints () const
+    {
+      size_t drawn = 0;
+      pcl::visualization::CloudActorMapPtr actors = viewer_->getCloudActorMap ();
+      if (!actors)
+        return (0);
+      for (pcl::visualization::CloudActorMap::iterator it = actors->begin (); it != actors->end (); ++it)
+      {
+        vtkLODActor* actor = it->second.actor;
+        if (!actor || !actor->GetVisibility () || !actor->GetMapper ())
+          continue;
+        vtkDataSet* data = actor->GetMapper ()->GetInput ();
+        if (data)
+          drawn += static_cast<size_t> (data->GetNumberOfPoints ());
+      }
+      return (drawn);
+    }
+
+    static void
+    onRender (vtkObject*, unsigned long event, void* client_data, void*)
+    {
+      PerfMonitor* monitor = static_cast<PerfMonitor*> (client_data);
+      if (event == vtkCommand::StartEvent)
+        monitor->frame_start_ = pcl::getTime ();
+      else if (monitor->frame_start_ > 0.0)
+        monitor->frame_ms_.push_back ((pcl::getTime () - monitor->frame_start_) * 1000.0);
+    }
+
+    boost::shared_ptr<pcl::visualization::PCLVisualizer> viewer_;
+    vtkSmartPointer<vtkRenderWindow> window_;
+    vtkSmartPointer<vtkCallbackCommand> callback_;
+    std::ofstream log_;
+    std::string text_;
+    std::vector<double> frame_ms_;
+    double start_time_, frame_start_, last_sample_;
+    size_t upload_bytes_;
+    unsigned long start_tag_, end_tag_;
+    bool visible_;
+};
+
+#endif  // PCL_VISUALIZER_PERF_HUD_H_
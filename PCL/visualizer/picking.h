@@ -0,0 +1,259 @@
+/* Click-to-pick: casts the view ray through an octree built when the cloud     */
+/* is loaded, and returns the first point it passes close to                     */
+
+#ifndef PCL_VISUALIZER_PICKING_H_
+#define PCL_VISUALIZER_PICKING_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/common/common.h>
+#include <pcl/console/time.h>
+#include <pcl/octree/octree_search.h>
+
+#include <vtkRenderer.h>
+
+#include "lod_octree.h"
+
+// ---------------------------------------
+// -----Text shown for a picked point-----
+// ---------------------------------------
+inline std::string
+describePoint (const pcl::PointXYZ& p, int index)
+{
+  char text[160];
+  sprintf (text, "#%d (%g, %g, %g)", index, p.x, p.y, p.z);
+  return (text);
+}
+
+inline std::string
+describePoint (const pcl::PointXYZI& p, int index)
+{
+  char text[160];
+  sprintf (text, "#%d (%g, %g, %g) intensity %g", index, p.x, p.y, p.z, p.intensity);
+  return (text);
+}
+
+inline std::string
+describePoint (const pcl::PointXYZRGB& p, int index)
+{
+  char text[160];
+  sprintf (text, "#%d (%g, %g, %g) rgb %d %d %d", index, p.x, p.y, p.z, p.r, p.g, p.b);
+  return (text);
+}
+
+// World-space ray through display pixel (x, y), from the near clipping plane
+// towards the far one
+inline bool
+getViewRay (vtkRenderer* renderer, double x, double y, Eigen::Vector3f& origin, Eigen::Vector3f& direction)
+{
+  double world[2][4];
+  for (int i = 0; i < 2; ++i)
+  {
+    renderer->SetDisplayPoint (x, y, i);
+    renderer->DisplayToWorld ();
+    renderer->GetWorldPoint (world[i]);
+    if (world[i][3] == 0.0)
+      return (false);
+  }
+  origin = Eigen::Vector3f (static_cast<float> (world[0][0] / world[0][3]), static_cast<float> (world[0][1] / world[0][3]),
+                            static_cast<float> (world[0][2] / world[0][3]));
+  Eigen::Vector3f far_point (static_cast<float> (world[1][0] / world[1][3]), static_cast<float> (world[1][1] / world[1][3]),
+                             static_cast<float> (world[1][2] / world[1][3]));
+  direction = far_point - origin;
+  float length = direction.norm ();
+  if (!(length > 0))
+    return (false);
+  direction /= length;
+  return (true);
+}
+
+
+class PointPicker
+{
+  public:
+    typedef boost::shared_ptr<PointPicker> Ptr;
+
+    virtual ~PointPicker () {}
+
+    // Index of the point the ray hits, or -1. spread is the radius, per unit
+    // of distance along the ray, within which a point counts as hit.
+    virtual int
+    pick (const Eigen::Vector3f& origin, const Eigen::Vector3f& direction, float spread) const = 0;
+
+    virtual std::string
+    describe (int index) const = 0;
+};
+
+
+// Only the leaves the ray passes through are visited, front to back, so a
+// pick costs about as much as walking one line through the grid of leaves
+template <typename PointT>
+class OctreePicker : public PointPicker
+{
+  public:
+    OctreePicker (const typename pcl::PointCloud<PointT>::ConstPtr& cloud) : cloud_ (cloud)
+    {
+      pcl::console::TicToc tt;
+      tt.tic ();
+      Eigen::Vector4f min_pt, max_pt;
+      pcl::getMinMax3D (*cloud, min_pt, max_pt);
+      // About as many leaves along an axis as the cube root of the point
+      // count; scans are mostly surfaces, so leaves end up holding a few
+      // hundred points at most
+      double diagonal = (max_pt - min_pt).head<3> ().norm ();
+      double side = std::max (16.0, std::pow (static_cast<double> (cloud->points.size ()), 1.0 / 3.0));
+      octree_.reset (new Octree (diagonal > 0 ? diagonal / side : 1.0));
+      octree_->setInputCloud (cloud);
+      octree_->addPointsFromInputCloud ();
+      std::cout << "Built the picking octree in " << tt.toc () << " ms\n";
+    }
+
+    // The first point along the ray within the spread; failing that, the
+    // one closest to the ray by angle among the leaves it crosses
+    int
+    pick (const Eigen::Vector3f& origin, const Eigen::Vector3f& direction, float spread) const
+    {
+      std::vector<int> indices;
+      octree_->getIntersectedVoxelIndices (origin, direction, indices);
+      int first = -1, closest = -1;
+      float first_t = std::numeric_limits<float>::max (), closest_angle = std::numeric_limits<float>::max ();
+      for (size_t i = 0; i < indices.size (); ++i)
+      {
+        Eigen::Vector3f v = cloud_->points[indices[i]].getVector3fMap () - origin;
+        float t = v.dot (direction);
+        if (t <= 0)
+          continue;
+        float off = (v - t * direction).norm ();
+        if (off <= spread * t && t < first_t)
+        {
+          first = indices[i];
+          first_t = t;
+        }
+        if (off < closest_angle * t)
+        {
+          closest = indices[i];
+          closest_angle = off / t;
+        }
+      }
+      return (first >= 0 ? first : closest);
+    }
+
+    std::string
+    describe (int index) const
+    {
+      return (describePoint (cloud_->points[index], index));
+    }
+
+  private:
+    typedef pcl::octree::OctreePointCloudSearch<PointT> Octree;
+
+    typename pcl::PointCloud<PointT>::ConstPtr cloud_;
+    boost::shared_ptr<Octree> octree_;
+};
+
+
+// Picks from a compacted LOD octree, whose points only exist quantised:
+// every leaf whose box the ray comes near is decoded and tested the way
+// OctreePicker tests its leaves. Indices are positions in leaf order, not
+// in the file.
+class LodPicker : public PointPicker
+{
+  public:
+    LodPicker (const boost::shared_ptr<LodRenderer>& lod) : lod_ (lod), octree_ (lod->getOctree ()) {}
+
+    int
+    pick (const Eigen::Vector3f& origin, const Eigen::Vector3f& direction, float spread) const
+    {
+      const std::vector<LodNode>& nodes = octree_.getNodes ();
+      const std::vector<int>& leaves = octree_.getLeaves ();
+      const CompactCloud& compact = octree_.getCompactCloud ();
+      int first = -1, closest = -1;
+      float first_t = std::numeric_limits<float>::max (), closest_angle = std::numeric_limits<float>::max ();
+      std::vector<pcl::PointXYZ> points;
+      for (size_t i = 0; i < leaves.size (); ++i)
+      {
+        const LodNode& leaf = nodes[leaves[i]];
+        if (!hitsBox (origin, direction, spread, leaf.min_pt, leaf.max_pt))
+          continue;
+        const CompactBlock& block = compact.getBlock (static_cast<int> (i));
+        points.resize (block.size);
+        compact.decode (static_cast<int> (i), block.size, &points[0]);
+        for (size_t j = 0; j < block.size; ++j)
+        {
+          Eigen::Vector3f v = points[j].getVector3fMap () - origin;
+          float t = v.dot (direction);
+          if (t <= 0)
+            continue;
+          float off = (v - t * direction).norm ();
+          if (off <= spread * t && t < first_t)
+          {
+            first = static_cast<int> (block.begin + j);
+            first_t = t;
+          }
+          if (off < closest_angle * t)
+          {
+            closest = static_cast<int> (block.begin + j);
+            closest_angle = off / t;
+          }
+        }
+      }
+      return (first >= 0 ? first : closest);
+    }
+
+    std::string
+    describe (int index) const
+    {
+      return (describePoint (octree_.getCompactCloud ().getPoint (index), index));
+    }
+
+  private:
+    // Slab test against the box grown by the spread at its far corner
+    static bool
+    hitsBox (const Eigen::Vector3f& origin, const Eigen::Vector3f& direction, float spread,
+             const float* min_pt, const float* max_pt)
+    {
+      Eigen::Vector3f lo (min_pt[0], min_pt[1], min_pt[2]), hi (max_pt[0], max_pt[1], max_pt[2]);
+      float reach = std::max ((lo - origin).norm (), (hi - origin).norm ()) + (hi - lo).norm ();
+      lo.array () -= spread * reach;
+      hi.array () += spread * reach;
+      float t0 = 0.0f, t1 = std::numeric_limits<float>::max ();
+      for (int k = 0; k < 3; ++k)
+      {
+        if (direction[k] == 0.0f)
+        {
+          if (origin[k] < lo[k] || origin[k] > hi[k])
+            return (false);
+          continue;
+        }
+        float a = (lo[k] - origin[k]) / direction[k], b = (hi[k] - origin[k]) / direction[k];
+        t0 = std::max (t0, std::min (a, b));
+        t1 = std::min (t1, std::max (a, b));
+      }
+      return (t0 <= t1);
+    }
+
+    boost::shared_ptr<LodRenderer> lod_;
+    const LodOctree& octree_;
+};
+
+
+// Picks at display pixel (x, y); points within a few pixels of it count
+inline int
+pickAtPixel (const PointPicker& picker, vtkRenderer* renderer, double x, double y, double pixels = 3.0)
+{
+  Eigen::Vector3f origin, direction, beside_origin, beside;
+  if (!getViewRay (renderer, x, y, origin, direction) || !getViewRay (renderer, x + pixels, y, beside_origin, beside))
+    return (-1);
+  return (picker.pick (origin, direction, (beside - direction).norm ()));
+}
+
+#endif  // PCL_VISUALIZER_PICKING_H_
@@ -0,0 +1,264 @@
+/* Ring buffer of point frames in shared memory, written by a producer process   */
+/* and read by the viewer; every slot is guarded by its own sequence counter     */
+
+#ifndef PCL_VISUALIZER_SHM_CLOUD_H_
+#define PCL_VISUALIZER_SHM_CLOUD_H_
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/static_assert.hpp>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+// The segment is a 64 byte header followed by slot_count slots. A slot is a
+// 64 byte header followed by up to capacity points in pcl::PointXYZ layout,
+// so producer and viewer exchange frames without any conversion.
+//
+// A frame n goes to slot n % slot_count. Its sequence is 2n + 1 while the
+// producer writes it and 2n + 2 once it is complete; a reader that sees the
+// same even value before and after copying has a consistent frame.
+static const char SHM_CLOUD_MAGIC[8] = { 'P', 'V', 'S', 'H', 'M', 'R', 'N', 'G' };
+static const boost::uint32_t SHM_CLOUD_VERSION = 1;
+static const size_t SHM_CLOUD_HEADER_BYTES = 64;
+
+struct ShmCloudHeader
+{
+  char magic[8];              // written last by the producer, cleared when it exits
+  boost::uint32_t version, point_bytes;
+  boost::uint32_t slot_count, reserved;
+  boost::uint64_t capacity, slot_bytes;
+  boost::atomic<boost::uint64_t> frames;    // frames completed so far
+};
+
+struct ShmSlotHeader
+{
+  boost::atomic<boost::uint64_t> sequence;
+  boost::uint64_t frame, count;
+};
+
+// A lock-based atomic would keep its lock in each process rather than in
+// the segment, so the counters must be lock-free to be shared
+BOOST_STATIC_ASSERT (BOOST_ATOMIC_INT64_LOCK_FREE == 2);
+BOOST_STATIC_ASSERT (sizeof (ShmCloudHeader) <= SHM_CLOUD_HEADER_BYTES);
+BOOST_STATIC_ASSERT (sizeof (ShmSlotHeader) <= SHM_CLOUD_HEADER_BYTES);
+
+inline size_t
+getShmSlotBytes (size_t capacity)
+{
+  size_t bytes = SHM_CLOUD_HEADER_BYTES + capacity * sizeof (pcl::PointXYZ);
+  return ((bytes + SHM_CLOUD_HEADER_BYTES - 1) / SHM_CLOUD_HEADER_BYTES * SHM_CLOUD_HEADER_BYTES);
+}
+
+
+// ---------------------------------------------
+// -----Producer side: fills slots in place-----
+// ---------------------------------------------
+class ShmCloudWriter
+{
+  public:
+    ShmCloudWriter () : header_ (0), next_ (0) {}
+
+    ~ShmCloudWriter ()
+    {
+      if (!header_)
+        return;
+      // Tells a viewer still attached to look for a new segment
+      std::memset (header_->magic, 0, sizeof (header_->magic));
+      boost::interprocess::shared_memory_object::remove (name_.c_str ());
+    }
+
+    // Replaces any segment of the same name left behind by a producer that
+    // did not exit cleanly
+    bool
+    create (const std::string& name, size_t slot_count, size_t capacity)
+    {
+      using namespace boost::interprocess;
+      name_ = name;
+      size_t slot_bytes = getShmSlotBytes (capacity);
+      try
+      {
+        shared_memory_object::remove (name.c_str ());
+        shared_memory_object shm (create_only, name.c_str (), read_write);
+        shm.truncate (static_cast<offset_t> (SHM_CLOUD_HEADER_BYTES + slot_count * slot_bytes));
+        mapped_region region (shm, read_write);
+        region_.swap (region);
+      }
+      catch (const interprocess_exception& e)
+      {
+        std::cerr << "Cannot create shared memory " << name << ": " << e.what () << std::endl;
+        return (false);
+      }
+
+      char* base = static_cast<char*> (region_.get_address ());
+      header_ = new (base) ShmCloudHeader;
+      header_->version = SHM_CLOUD_VERSION;
+      header_->point_bytes = sizeof (pcl::PointXYZ);
+      header_->slot_count = static_cast<boost::uint32_t> (slot_count);
+      header_->reserved = 0;
+      header_->capacity = capacity;
+      header_->slot_bytes = slot_bytes;
+      header_->frames.store (0, boost::memory_order_relaxed);
+      for (size_t i = 0; i < slot_count; ++i)
+        new (base + SHM_CLOUD_HEADER_BYTES + i * slot_bytes) ShmSlotHeader;
+      boost::atomic_thread_fence (boost::memory_order_release);
+      std::memcpy (header_->magic, SHM_CLOUD_MAGIC, sizeof (SHM_CLOUD_MAGIC));
+      return (true);
+    }
+
+    size_t
+    getCapacity () const
+    {
+      return (static_cast<size_t> (header_->capacity));
+    }
+
+    // Points of the next frame are written straight into the returned slot
+    pcl::PointXYZ*
+    beginFrame ()
+    {
+      ShmSlotHeader* slot = getSlot ();
+      slot->sequence.store (2 * next_ + 1, boost::memory_order_relaxed);
+      boost::atomic_thread_fence (boost::memory_order_release);
+      return (reinterpret_cast<pcl::PointXYZ*> (reinterpret_cast<char*> (slot) + SHM_CLOUD_HEADER_BYTES));
+    }
+
+    void
+    commitFrame (size_t count)
+    {
+      ShmSlotHeader* slot = getSlot ();
+      slot->frame = next_;
+      slot->count = std::min<boost::uint64_t> (count, header_->capacity);
+      slot->sequence.store (2 * next_ + 2, boost::memory_order_release);
+      header_->frames.store (++next_, boost::memory_order_release);
+    }
+
+  private:
+    ShmSlotHeader*
+    getSlot () const
+    {
+      char* base = static_cast<char*> (region_.get_address ());
+      return (reinterpret_cast<ShmSlotHeader*> (base + SHM_CLOUD_HEADER_BYTES + (next_ % header_->slot_count) * header_->slot_bytes));
+    }
+
+    std::string name_;
+    boost::interprocess::mapped_region region_;
+    ShmCloudHeader* header_;
+    boost::uint64_t next_;
+};
+
+
+// -----------------------------------------------------------
+// -----Viewer side: copies out the newest complete frame-----
+// -----------------------------------------------------------
+class ShmCloudReader
+{
+  public:
+    ShmCloudReader (const std::string& name) : name_ (name), header_ (0), seen_ (0), dropped_ (0), warned_ (false) {}
+
+    // False until a producer has created and initialised the segment
+    bool
+    open ()
+    {
+      using namespace boost::interprocess;
+      try
+      {
+        shared_memory_object shm (open_only, name_.c_str (), read_write);
+        mapped_region region (shm, read_write);
+        region_.swap (region);
+      }
+      catch (const interprocess_exception&)
+      {
+        return (false);
+      }
+
+      const ShmCloudHeader* header = static_cast<const ShmCloudHeader*> (region_.get_address ());
+      if (region_.get_size () < SHM_CLOUD_HEADER_BYTES ||
+          std::memcmp (header->magic, SHM_CLOUD_MAGIC, sizeof (SHM_CLOUD_MAGIC)) != 0)
+        return (false);
+      boost::atomic_thread_fence (boost::memory_order_acquire);
+      if (header->version != SHM_CLOUD_VERSION || header->point_bytes != sizeof (pcl::PointXYZ) ||
+          header->slot_count == 0 || header->slot_bytes < getShmSlotBytes (static_cast<size_t> (header->capacity)) ||
+          region_.get_size () < SHM_CLOUD_HEADER_BYTES + header->slot_count * header->slot_bytes)
+      {
+        if (!warned_)
+          std::cerr << "Shared memory " << name_ << " is not a compatible point ring buffer" << std::endl;
+        warned_ = true;
+        return (false);
+      }
+      header_ = const_cast<ShmCloudHeader*> (header);
+      seen_ = 0;
+      return (true);
+    }
+
+    bool
+    isOpen () const
+    {
+      return (header_ != 0);
+    }
+
+    // Frames the producer completed that were overwritten before they could
+    // be shown
+    boost::uint64_t
+    getDroppedFrames () const
+    {
+      return (dropped_);
+    }
+
+    // Copies the newest complete frame into cloud if there is one that was
+    // not read yet. A frame overwritten during the copy is retried with the
+    // one that replaced it.
+    bool
+    readLatest (pcl::PointCloud<pcl::PointXYZ>& cloud)
+    {
+      if (header_ && header_->magic[0] == 0)
+        header_ = 0;        // the producer exited; wait for the next one
+      if (!header_ && !open ())
+        return (false);
+
+      for (int attempt = 0; attempt < 4; ++attempt)
+      {
+        boost::uint64_t frames = header_->frames.load (boost::memory_order_acquire);
+        if (frames == seen_)
+          return (false);
+        boost::uint64_t frame = frames - 1;
+        const char* slot = static_cast<const char*> (region_.get_address ()) + SHM_CLOUD_HEADER_BYTES +
+                           (frame % header_->slot_count) * header_->slot_bytes;
+        const ShmSlotHeader* slot_header = reinterpret_cast<const ShmSlotHeader*> (slot);
+        boost::uint64_t sequence = slot_header->sequence.load (boost::memory_order_acquire);
+        if (sequence != 2 * frame + 2)
+          continue;
+        size_t count = static_cast<size_t> (std::min (slot_header->count, header_->capacity));
+        cloud.points.resize (count);
+        if (count)
+          std::memcpy (&cloud.points[0], slot + SHM_CLOUD_HEADER_BYTES, count * sizeof (pcl::PointXYZ));
+        boost::atomic_thread_fence (boost::memory_order_acquire);
+        if (slot_header->sequence.load (boost::memory_order_relaxed) != sequence)
+          continue;
+
+        if (seen_)
+          dropped_ += frame - seen_;
+        seen_ = frames;
+        cloud.width = static_cast<uint32_t> (count);
+        cloud.height = 1;
+        cloud.is_dense = false;
+        return (true);
+      }
+      return (false);
+    }
+
+  private:
+    std::string name_;
+    boost::interprocess::mapped_region region_;
+    ShmCloudHeader* header_;
+    boost::uint64_t seen_, dropped_;
+    bool warned_;
+};
+
+#endif  // PCL_VISUALIZER_SHM_CLOUD_H_
@@ -0,0 +1,116 @@
+/* Reference producer for pcl_visualizer --shm: publishes an animated surface    */
+/* into the shared-memory ring buffer at a fixed frame rate                      */
+
+#include <algorithm>
+#include <cmath>
+#include <csignal>
+#include <iostream>
+#include <string>
+
+#include <boost/thread/thread.hpp>
+#include <pcl/console/parse.h>
+#include <pcl/console/time.h>
+
+#include "shm_cloud.h"
+
+static volatile std::sig_atomic_t stop_requested = 0;
+
+void
+onSignal (int)
+{
+  stop_requested = 1;
+}
+
+// --------------
+// -----Help-----
+// --------------
+void
+printUsage (const char* progName)
+{
+  std::cout << "\n\nUsage: "<<progName<<" [options]\n\n"
+            << "Options:\n"
+            << "-------------------------------------------\n"
+            << "-h           this help\n"
+            << "--shm        Name of the shared memory segment (default pcl_visualizer)\n"
+            << "-p           Points per frame (default 1000000)\n"
+            << "-r           Frames per second (default 30)\n"
+            << "--slots      Frames held by the ring buffer (default 4)\n"
+            << "\n"
+            << "Then run: pcl_visualizer --shm <name>\n"
+            << "\n\n";
+}
+
+// Square grid of side points with z = sin (x + t) * cos (y + t), written
+// straight into the slot
+void
+fillFrame (pcl::PointXYZ* points, int side, float t)
+{
+  const float step = 10.0f / side;
+#pragma omp parallel for
+  for (int row = 0; row < side; ++row)
+  {
+    float y = row * step - 5.0f;
+    for (int col = 0; col < side; ++col)
+    {
+      pcl::PointXYZ& p = points[row * side + col];
+      p.x = col * step - 5.0f;
+      p.y = y;
+      p.z = std::sin (p.x + t) * std::cos (y + t);
+    }
+  }
+}
+
+// --------------
+// -----Main-----
+// --------------
+int
+main (int argc, char** argv)
+{
+  if (pcl::console::find_argument (argc, argv, "-h") >= 0)
+  {
+    printUsage (argv[0]);
+    return 0;
+  }
+  std::string name = "pcl_visualizer";
+  int points = 1000000, rate = 30, slots = 4;
+  pcl::console::parse_argument (argc, argv, "--shm", name);
+  pcl::console::parse_argument (argc, argv, "-p", points);
+  pcl::console::parse_argument (argc, argv, "-r", rate);
+  pcl::console::parse_argument (argc, argv, "--slots", slots);
+  int side = std::max (1, static_cast<int> (std::sqrt (static_cast<double> (points))));
+  rate = std::max (1, rate);
+
+  ShmCloudWriter writer;
+  if (!writer.create (name, static_cast<size_t> (std::max (2, slots)), static_cast<size_t> (side) * side))
+    return (-1);
+  std::signal (SIGINT, onSignal);
+  std::signal (SIGTERM, onSignal);
+  std::cout << "Publishing " << side * side << " points per frame at " << rate << " fps to " << name
+            << "; Ctrl-C to stop\n";
+
+  pcl::console::TicToc clock, frame_time;
+  clock.tic ();
+  double period = 1000.0 / rate, next = 0.0, fill_ms = 0.0;
+  unsigned int frames = 0;
+  while (!stop_requested)
+  {
+    frame_time.tic ();
+    fillFrame (writer.beginFrame (), side, static_cast<float> (clock.toc () * 0.001));
+    writer.commitFrame (static_cast<size_t> (side) * side);
+    fill_ms += frame_time.toc ();
+    if (++frames % rate == 0)
+    {
+      std::cout << "frame " << frames << ", " << fill_ms / rate << " ms to fill\n";
+      fill_ms = 0.0;
+    }
+
+    // Keeps the average rate even when a frame takes longer than the period
+    next += period;
+    double wait = next - clock.toc ();
+    if (wait > 0)
+      boost::this_thread::sleep (boost::posix_time::milliseconds (static_cast<long> (wait)));
+    else
+      next = clock.toc ();
+  }
+  return (0);
+}
@@ -0,0 +1,302 @@
+/* Software point renderer for machines without a GPU or a display: points are   */
+/* binned into screen tiles and each tile is splatted with a z-buffer            */
+
+#ifndef PCL_VISUALIZER_SPLAT_RENDERER_H_
+#define PCL_VISUALIZER_SPLAT_RENDERER_H_
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/filesystem.hpp>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/common/common.h>
+#include <pcl/console/time.h>
+#include <pcl/io/png_io.h>
+#include <pcl/visualization/pcl_visualizer.h>
+
+#include "xyz_loader.h"
+
+static const int SPLAT_TILE = 32;
+static const int SPLAT_MAX_RADIUS = 8;
+static const int SPLAT_BATCH = 1 << 22;
+
+// One projected point: its pixel, depth along the view, colour and radius
+// in pixels (0 for a single pixel)
+struct Splat
+{
+  float depth;
+  boost::int16_t x, y;
+  boost::uint8_t rgb[3];
+  boost::uint8_t radius;
+};
+
+// ----------------------------------------
+// -----Colour of a point in the image-----
+// ----------------------------------------
+// Plain XYZ is white, as PCLVisualizer draws it without a colour handler;
+// intensity is a grey ramp over the cloud's range
+inline void
+getSplatColour (const pcl::PointXYZ&, float, float, boost::uint8_t* rgb)
+{
+  rgb[0] = rgb[1] = rgb[2] = 255;
+}
+
+inline void
+getSplatColour (const pcl::PointXYZRGB& p, float, float, boost::uint8_t* rgb)
+{
+  rgb[0] = p.r;
+  rgb[1] = p.g;
+  rgb[2] = p.b;
+}
+
+inline void
+getSplatColour (const pcl::PointXYZI& p, float offset, float scale, boost::uint8_t* rgb)
+{
+  float v = std::max (0.0f, std::min (255.0f, (p.intensity - offset) * scale));
+  rgb[0] = rgb[1] = rgb[2] = static_cast<boost::uint8_t> (v + 0.5f);
+}
+
+template <typename PointT> void
+getSplatColourRange (const pcl::PointCloud<PointT>&, float& offset, float& scale)
+{
+  offset = 0.0f;
+  scale = 1.0f;
+}
+
+inline void
+getSplatColourRange (const pcl::PointCloud<pcl::PointXYZI>& cloud, float& offset, float& scale)
+{
+  float lo = std::numeric_limits<float>::max (), hi = -lo;
+  for (size_t i = 0; i < cloud.points.size (); ++i)
+    if (pcl_isfinite (cloud.points[i].intensity))
+    {
+      lo = std::min (lo, cloud.points[i].intensity);
+      hi = std::max (hi, cloud.points[i].intensity);
+    }
+  offset = lo;
+  scale = (hi > lo ? 255.0f / (hi - lo) : 1.0f);
+}
+
+
+class SplatRenderer
+{
+  public:
+    // point_size is the diameter of a point in world units; 0 picks one from
+    // the spacing of the cloud that is rendered
+    SplatRenderer (const pcl::visualization::Camera& camera, float point_size = 0.0f) :
+      camera_ (camera), point_size_ (point_size)
+    {
+      width_ = std::max (1, static_cast<int> (camera.window_size[0]));
+      height_ = std::max (1, static_cast<int> (camera.window_size[1]));
+      tiles_x_ = (width_ + SPLAT_TILE - 1) / SPLAT_TILE;
+      tiles_y_ = (height_ + SPLAT_TILE - 1) / SPLAT_TILE;
+
+      // Same frame as a VTK camera: looking from pos at focal, view up
+      // re-orthogonalised against the view direction
+      eye_ = Eigen::Vector3f (static_cast<float> (camera.pos[0]), static_cast<float> (camera.pos[1]),
+                              static_cast<float> (camera.pos[2]));
+      forward_ = Eigen::Vector3f (static_cast<float> (camera.focal[0]), static_cast<float> (camera.focal[1]),
+                                  static_cast<float> (camera.focal[2])) - eye_;
+      forward_.normalize ();
+      Eigen::Vector3f up (static_cast<float> (camera.view[0]), static_cast<float> (camera.view[1]),
+                          static_cast<float> (camera.view[2]));
+      right_ = forward_.cross (up).normalized ();
+      up_ = right_.cross (forward_);
+      focal_px_ = static_cast<float> (0.5 * height_ / std::tan (camera.fovy * 0.5));
+      clear ();
+    }
+
+    void
+    clear ()
+    {
+      colour_.assign (static_cast<size_t> (width_) * height_ * 3, 0);
+      depth_.assign (static_cast<size_t> (width_) * height_, std::numeric_limits<float>::infinity ());
+    }
+
+    // Draws the cloud into the current image and returns the number of
+    // points that landed in view
+    template <typename PointT> size_t
+    render (const pcl::PointCloud<PointT>& cloud)
+    {
+      pcl::console::TicToc tt;
+      tt.tic ();
+      const int n = static_cast<int> (cloud.points.size ());
+      const int chunks = getNumberOfThreads ();
+      const int tiles = tiles_x_ * tiles_y_;
+      float offset, scale;
+      getSplatColourRange (cloud, offset, scale);
+      float point_size = (point_size_ > 0 ? point_size_ : estimatePointSize (cloud));
+      const float near_clip = static_cast<float> (camera_.clip[0]), far_clip = static_cast<float> (camera_.clip[1]);
+
+      // bins[c * tiles + t]: splats of chunk c that touch tile t, reused
+      // from batch to batch
+      std::vector<std::vector<Splat> > bins (static_cast<size_t> (chunks) * tiles);
+      size_t drawn = 0;
+      for (int batch = 0; batch < n; batch += SPLAT_BATCH)
+      {
+        const int batch_end = std::min (n, batch + SPLAT_BATCH);
+        const int batch_size = batch_end - batch;
+
+        // Project and bin, one chunk of the batch per thread
+#pragma omp parallel for reduction (+:drawn)
+        for (int c = 0; c < chunks; ++c)
+        {
+          std::vector<Splat>* mine = &bins[static_cast<size_t> (c) * tiles];
+          for (int t = 0; t < tiles; ++t)
+            mine[t].clear ();
+          int begin = batch + static_cast<int> (static_cast<long long> (batch_size) * c / chunks);
+          int end = batch + static_cast<int> (static_cast<long long> (batch_size) * (c + 1) / chunks);
+          for (int i = begin; i < end; ++i)
+          {
+            const PointT& p = cloud.points[i];
+            Eigen::Vector3f v = Eigen::Vector3f (p.x, p.y, p.z) - eye_;
+            float depth = v.dot (forward_);
+            if (!(depth >= near_clip && depth <= far_clip))
+              continue;           // also drops NaN points
+            float inv = focal_px_ / depth;
+            float sx = 0.5f * width_ + v.dot (right_) * inv;
+            float sy = 0.5f * height_ - v.dot (up_) * inv;
+            int radius = std::min (SPLAT_MAX_RADIUS, static_cast<int> (0.5f * point_size * inv));
+            if (!(sx >= -radius && sy >= -radius && sx < width_ + radius && sy < height_ + radius))
+              continue;
+
+            Splat s;
+            s.depth = depth;
+            s.x = static_cast<boost::int16_t> (std::floor (sx));
+            s.y = static_cast<boost::int16_t> (std::floor (sy));
+            s.radius = static_cast<boost::uint8_t> (radius);
+            getSplatColour (p, offset, scale, s.rgb);
+            int tx0 = std::max (0, (s.x - radius) / SPLAT_TILE);
+            int tx1 = std::min (tiles_x_ - 1, (s.x + radius) / SPLAT_TILE);
+            int ty0 = std::max (0, (s.y - radius) / SPLAT_TILE);
+            int ty1 = std::min (tiles_y_ - 1, (s.y + radius) / SPLAT_TILE);
+            for (int ty = ty0; ty <= ty1; ++ty)
+              for (int tx = tx0; tx <= tx1; ++tx)
+                mine[ty * tiles_x_ + tx].push_back (s);
+            ++drawn;
+          }
+        }
+
+        // Rasterise; every tile is written by one thread only
+#pragma omp parallel for schedule (dynamic)
+        for (int t = 0; t < tiles; ++t)
+          for (int c = 0; c < chunks; ++c)
+            rasterise (t, bins[static_cast<size_t> (c) * tiles + t]);
+      }
+
+      double ms = tt.toc ();
+      std::cerr << "Splatted " << drawn << " of " << n << " points into " << width_ << "x" << height_ << " in " << ms
+                << " ms: " << n / (ms * 0.001 + 1e-9) << " points/s on " << getNumberOfThreads () << " threads\n";
+      return (drawn);
+    }
+
+    bool
+    saveColour (const std::string& filename) const
+    {
+      removeImage (filename);
+      pcl::io::saveRgbPNGFile (filename, &colour_[0], width_, height_);
+      return (checkImage (filename));
+    }
+
+    // 16 bit depth along the view in steps of unit, in the cloud's units
+    // (0.001 gives millimetres for a cloud in metres); 0 where nothing was
+    // drawn. Depths past 65535 steps are written as 65535 and counted.
+    bool
+    saveDepth (const std::string& filename, float unit = 0.001f) const
+    {
+      std::vector<unsigned short> depth (depth_.size ());
+      const float scale = 1.0f / unit;
+      size_t saturated = 0;
+      for (size_t i = 0; i < depth_.size (); ++i)
+      {
+        if (!(depth_[i] < std::numeric_limits<float>::infinity ()))
+        {
+          depth[i] = 0;
+          continue;
+        }
+        float steps = depth_[i] * scale + 0.5f;
+        saturated += (steps >= 65535.0f);
+        depth[i] = static_cast<unsigned short> (std::min (65535.0f, steps));
+      }
+      if (saturated)
+        std::cerr << saturated << " depth pixels lie beyond " << 65535.0f * unit
+                  << " and were written as 65535; use a larger depth unit" << std::endl;
+      removeImage (filename);
+      pcl::io::saveShortPNGFile (filename, &depth[0], width_, height_, 1);
+      return (checkImage (filename));
+    }
+
+  private:
+    // The PNG writers do not report errors, so an old file is removed first
+    // and the new one is looked for afterwards
+    static void
+    removeImage (const std::string& filename)
+    {
+      boost::system::error_code ec;
+      boost::filesystem::remove (filename, ec);
+    }
+
+    static bool
+    checkImage (const std::string& filename)
+    {
+      boost::system::error_code ec;
+      if (boost::filesystem::exists (filename, ec) && boost::filesystem::file_size (filename, ec) > 0 && !ec)
+        return (true);
+      std::cerr << "Could not write " << filename << std::endl;
+      return (false);
+    }
+
+    void
+    rasterise (int tile, const std::vector<Splat>& splats)
+    {
+      const int x0 = (tile % tiles_x_) * SPLAT_TILE, y0 = (tile / tiles_x_) * SPLAT_TILE;
+      const int x1 = std::min (width_, x0 + SPLAT_TILE), y1 = std::min (height_, y0 + SPLAT_TILE);
+      for (size_t i = 0; i < splats.size (); ++i)
+      {
+        const Splat& s = splats[i];
+        const int r = s.radius;
+        const int r2 = r * r + r;       // rounder discs for small radii
+        for (int y = std::max (y0, s.y - r); y < std::min (y1, s.y + r + 1); ++y)
+          for (int x = std::max (x0, s.x - r); x < std::min (x1, s.x + r + 1); ++x)
+          {
+            if ((x - s.x) * (x - s.x) + (y - s.y) * (y - s.y) > r2)
+              continue;
+            size_t pixel = static_cast<size_t> (y) * width_ + x;
+            if (s.depth < depth_[pixel])
+            {
+              depth_[pixel] = s.depth;
+              colour_[3 * pixel] = s.rgb[0];
+              colour_[3 * pixel + 1] = s.rgb[1];
+              colour_[3 * pixel + 2] = s.rgb[2];
+            }
+          }
+      }
+    }
+
+    // Spacing of points spread evenly over the bounding box's largest face
+    template <typename PointT> float
+    estimatePointSize (const pcl::PointCloud<PointT>& cloud) const
+    {
+      Eigen::Vector4f min_pt, max_pt;
+      pcl::getMinMax3D (cloud, min_pt, max_pt);
+      Eigen::Vector3f extent = (max_pt - min_pt).head<3> ();
+      std::sort (extent.data (), extent.data () + 3);
+      double area = static_cast<double> (extent[1]) * extent[2];
+      return (cloud.points.empty () || !(area > 0) ? 0.0f : static_cast<float> (std::sqrt (area / cloud.points.size ())));
+    }
+
+    pcl::visualization::Camera camera_;
+    float point_size_, focal_px_;
+    int width_, height_, tiles_x_, tiles_y_;
+    Eigen::Vector3f eye_, forward_, right_, up_;
+    std::vector<boost::uint8_t> colour_;
+    std::vector<float> depth_;
+};
+
+#endif  // PCL_VISUALIZER_SPLAT_RENDERER_H_
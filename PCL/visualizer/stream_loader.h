@@ -0,0 +1,142 @@
+/* Background parser that hands a text cloud to the viewer in batches            */
+
+#ifndef PCL_VISUALIZER_STREAM_LOADER_H_
+#define PCL_VISUALIZER_STREAM_LOADER_H_
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/thread/thread.hpp>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "bounded_queue.h"
+#include "xyz_loader.h"
+
+struct PointBatch
+{
+  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud;
+  size_t bytes;
+};
+
+
+class StreamLoader
+{
+  public:
+    StreamLoader () : batches_ (8), total_bytes_ (0), parsed_bytes_ (0) {}
+
+    ~StreamLoader ()
+    {
+      batches_.close ();
+      if (thread_.joinable ())
+        thread_.join ();
+    }
+
+    // An empty file cannot be mapped; it is done at once with no points
+    bool
+    start (const std::string& filename)
+    {
+      boost::system::error_code ec;
+      if (boost::filesystem::file_size (filename, ec) == 0 && !ec)
+      {
+        total_bytes_ = 0;
+        batches_.close ();
+        return (true);
+      }
+      try
+      {
+        file_.open (filename);
+      }
+      catch (const std::exception& e)
+      {
+        std::cerr << "Could not map " << filename << ": " << e.what () << std::endl;
+        return (false);
+      }
+      total_bytes_ = file_.size ();
+      thread_ = boost::thread (&StreamLoader::run, this);
+      return (true);
+    }
+
+    // Appends every batch parsed so far to cloud; returns true if it grew
+    bool
+    drain (pcl::PointCloud<pcl::PointXYZ>& cloud)
+    {
+      bool grew = false;
+      PointBatch batch;
+      while (batches_.tryPop (batch))
+      {
+        cloud.points.insert (cloud.points.end (), batch.cloud->points.begin (), batch.cloud->points.end ());
+        parsed_bytes_ += batch.bytes;
+        grew = true;
+      }
+      cloud.width = static_cast<uint32_t> (cloud.points.size ());
+      cloud.height = 1;
+      cloud.is_dense = true;
+      return (grew);
+    }
+
+    bool
+    isDone () const
+    {
+      return (batches_.isDone ());
+    }
+
+    size_t
+    getTotalBytes () const
+    {
+      return (total_bytes_);
+    }
+
+    size_t
+    getParsedBytes () const
+    {
+      return (parsed_bytes_);
+    }
+
+  private:
+    // Blocks start small so the first points show up right away and grow so
+    // the per-batch overhead vanishes on large files
+    void
+    run ()
+    {
+      const size_t max_block = 64 << 20;
+      size_t block = 1 << 20;
+      const char* p = file_.data ();
+      const char* end = p + file_.size ();
+      while (p < end)
+      {
+        const char* stop = end;
+        if (static_cast<size_t> (end - p) > block)
+        {
+          const char* eol = static_cast<const char*> (std::memchr (p + block, '\n', end - p - block));
+          stop = eol ? eol + 1 : end;
+        }
+
+        PointBatch batch;
+        batch.cloud.reset (new pcl::PointCloud<pcl::PointXYZ>);
+        size_t consumed = parseXYZBuffer (p, stop, *batch.cloud);
+        batch.bytes = consumed;
+        if (!batches_.push (batch))
+          return;
+        if (p + consumed < stop)
+        {
+          std::cerr << "Stopped at malformed line at byte " << (p + consumed - file_.data ()) << std::endl;
+          break;
+        }
+        p = stop;
+        block = std::min (block * 2, max_block);
+      }
+      batches_.close ();
+    }
+
+    boost::iostreams::mapped_file_source file_;
+    boost::thread thread_;
+    BoundedQueue<PointBatch> batches_;
+    size_t total_bytes_, parsed_bytes_;
+};
+
+#endif  // PCL_VISUALIZER_STREAM_LOADER_H_
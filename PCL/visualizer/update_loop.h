@@ -0,0 +1,170 @@
+/* Event-driven viewer loop: VTK's interactor blocks until there is input, and   */
+/* a repeating timer runs background work only while some of it is pending       */
+
+#ifndef PCL_VISUALIZER_UPDATE_LOOP_H_
+#define PCL_VISUALIZER_UPDATE_LOOP_H_
+
+#include <vector>
+
+#include <boost/function.hpp>
+#include <pcl/visualization/pcl_visualizer.h>
+
+#include <vtkCallbackCommand.h>
+#include <vtkCamera.h>
+#include <vtkCommand.h>
+#include <vtkRenderer.h>
+#include <vtkRendererCollection.h>
+#include <vtkRenderWindow.h>
+#include <vtkRenderWindowInteractor.h>
+#include <vtkSmartPointer.h>
+
+class UpdateLoop
+{
+  public:
+    // Flags a ticker returns: TICK_BUSY keeps the timer running, TICK_REDRAW
+    // renders the window once all tickers ran
+    enum
+    {
+      TICK_IDLE = 0,
+      TICK_BUSY = 1,
+      TICK_REDRAW = 2
+    };
+    typedef boost::function<int ()> Ticker;
+    typedef boost::function<bool ()> Check;
+
+    UpdateLoop (const boost::shared_ptr<pcl::visualization::PCLVisualizer>& viewer, int interval_ms = 30) :
+      viewer_ (viewer), interactor_ (NULL), camera_ (NULL), interval_ms_ (interval_ms), timer_ (-1),
+      check_timer_ (-1), check_ms_ (250), timer_tag_ (0), camera_tag_ (0)
+    {
+      vtkSmartPointer<vtkRenderWindow> window = viewer_->getRenderWindow ();
+      if (window)
+        interactor_ = window->GetInteractor ();
+      vtkSmartPointer<vtkRendererCollection> renderers = viewer_->getRendererCollection ();
+      if (renderers && renderers->GetFirstRenderer ())
+        camera_ = renderers->GetFirstRenderer ()->GetActiveCamera ();
+
+      if (interactor_)
+      {
+        timer_callback_ = vtkSmartPointer<vtkCallbackCommand>::New ();
+        timer_callback_->SetCallback (&UpdateLoop::onTimer);
+        timer_callback_->SetClientData (this);
+        timer_tag_ = interactor_->AddObserver (vtkCommand::TimerEvent, timer_callback_);
+      }
+      // Viewports share the first renderer's camera, so one observer sees
+      // every move, whether it comes from the mouse, a key or the code
+      if (camera_)
+      {
+        camera_callback_ = vtkSmartPointer<vtkCallbackCommand>::New ();
+        camera_callback_->SetCallback (&UpdateLoop::onCameraModified);
+        camera_callback_->SetClientData (this);
+        camera_tag_ = camera_->AddObserver (vtkCommand::ModifiedEvent, camera_callback_);
+      }
+    }
+
+    ~UpdateLoop ()
+    {
+      stopTimer ();
+      if (check_timer_ >= 0 && interactor_)
+        interactor_->DestroyTimer (check_timer_);
+      if (interactor_)
+        interactor_->RemoveObserver (timer_tag_);
+      if (camera_)
+        camera_->RemoveObserver (camera_tag_);
+    }
+
+    void
+    addTicker (const Ticker& ticker)
+    {
+      tickers_.push_back (ticker);
+      wake ();
+    }
+
+    // Work that arrives from another thread: check runs on a slow timer of
+    // its own, which never stops, and wakes the loop when it returns true.
+    // Only this thread touches the interactor.
+    void
+    addCheck (const Check& check)
+    {
+      checks_.push_back (check);
+      if (check_timer_ < 0 && interactor_)
+        check_timer_ = interactor_->CreateRepeatingTimer (check_ms_);
+    }
+
+    // Starts the timer if it is not running; tickers run until all are idle
+    void
+    wake ()
+    {
+      if (timer_ < 0 && interactor_)
+        timer_ = interactor_->CreateRepeatingTimer (interval_ms_);
+    }
+
+    // Returns when the window is closed or 'q' is pressed
+    void
+    run ()
+    {
+      viewer_->spin ();
+    }
+
+  private:
+    void
+    tick ()
+    {
+      int flags = TICK_IDLE;
+      for (size_t i = 0; i < tickers_.size (); ++i)
+        flags |= tickers_[i] ();
+      if (flags & TICK_REDRAW)
+        viewer_->getRenderWindow ()->Render ();
+      if (!(flags & TICK_BUSY))
+        stopTimer ();
+    }
+
+    void
+    check ()
+    {
+      for (size_t i = 0; i < checks_.size (); ++i)
+        if (checks_[i] ())
+        {
+          wake ();
+          return;
+        }
+    }
+
+    void
+    stopTimer ()
+    {
+      if (timer_ >= 0 && interactor_)
+        interactor_->DestroyTimer (timer_);
+      timer_ = -1;
+    }
+
+    static void
+    onTimer (vtkObject*, unsigned long, void* client_data, void* call_data)
+    {
+      UpdateLoop* loop = static_cast<UpdateLoop*> (client_data);
+      // The interactor style and PCLVisualizer run timers of their own
+      if (!call_data)
+        return;
+      int timer = *static_cast<int*> (call_data);
+      if (timer == loop->timer_)
+        loop->tick ();
+      else if (timer == loop->check_timer_)
+        loop->check ();
+    }
+
+    static void
+    onCameraModified (vtkObject*, unsigned long, void* client_data, void*)
+    {
+      static_cast<UpdateLoop*> (client_data)->wake ();
+    }
+
+    boost::shared_ptr<pcl::visualization::PCLVisualizer> viewer_;
+    vtkRenderWindowInteractor* interactor_;
+    vtkCamera* camera_;
+    vtkSmartPointer<vtkCallbackCommand> timer_callback_, camera_callback_;
+    std::vector<Ticker> tickers_;
+    std::vector<Check> checks_;
+    int interval_ms_, timer_, check_timer_, check_ms_;
+    unsigned long timer_tag_, camera_tag_;
+};
+
+#endif  // PCL_VISUALIZER_UPDATE_LOOP_H_
@@ -0,0 +1,584 @@
+/* Parallel loader for whitespace separated X Y Z text files                     */
+/* The file is memory mapped, split at line boundaries and parsed on all cores   */
+/* Four column files load as XYZI and six column files as XYZRGB                 */
+/* .gz / .zst files are decompressed on one thread while the others parse        */
+
+#ifndef PCL_VISUALIZER_XYZ_LOADER_H_
+#define PCL_VISUALIZER_XYZ_LOADER_H_
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/function.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/console/time.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "decompress.h"
+
+
+inline int
+getNumberOfThreads ()
+{
+#ifdef _OPENMP
+  return (omp_get_max_threads ());
+#else
+  return (1);
+#endif
+}
+
+
+inline bool
+isBlank (char c)
+{
+  return (c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f');
+}
+
+
+// --------------------------------------------------------------
+// -----Locale independent float parsing (fast path + strtof)-----
+// --------------------------------------------------------------
+inline bool
+parseFloatSlow (const char* begin, const char* end, float& value)
+{
+  // strtof needs a terminated string; numbers this long are rare
+  std::string token (begin, end);
+  char* stop;
+  value = std::strtof (token.c_str (), &stop);
+  return (stop == token.c_str () + token.size ());
+}
+
+// Parses one number starting at p and leaves p on the character after it.
+// Returns false if the token is not a plain decimal number, like the
+// "datafile >> x" extraction it replaces.
+inline bool
+parseFloat (const char*& p, const char* end, float& value)
+{
+  static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+  const char* s = p;
+  bool negative = false;
+  if (s < end && (*s == '-' || *s == '+'))
+    negative = (*s++ == '-');
+
+  uint64_t mantissa = 0;
+  int significant = 0, exponent = 0;
+  bool digits = false, exact = true;
+  for (; s < end && *s >= '0' && *s <= '9'; ++s)
+  {
+    digits = true;
+    if (significant < 19)
+    {
+      mantissa = mantissa * 10 + (*s - '0');
+      if (mantissa != 0)
+        ++significant;
+    }
+    else
+    {
+      exact &= (*s == '0');
+      ++exponent;
+    }
+  }
+  if (s < end && *s == '.')
+  {
+    for (++s; s < end && *s >= '0' && *s <= '9'; ++s)
+    {
+      digits = true;
+      if (significant < 19)
+      {
+        mantissa = mantissa * 10 + (*s - '0');
+        if (mantissa != 0)
+          ++significant;
+        --exponent;
+      }
+      else
+        exact &= (*s == '0');
+    }
+  }
+  if (!digits)
+    return (false);
+
+  if (s < end && (*s == 'e' || *s == 'E'))
+  {
+    const char* e = s + 1;
+    bool negative_exponent = false;
+    if (e < end && (*e == '-' || *e == '+'))
+      negative_exponent = (*e++ == '-');
+    if (e < end && *e >= '0' && *e <= '9')
+    {
+      int n = 0;
+      for (; e < end && *e >= '0' && *e <= '9'; ++e)
+        if (n < 10000)
+          n = n * 10 + (*e - '0');
+      exponent += negative_exponent ? -n : n;
+      s = e;
+    }
+  }
+  // The number has to be followed by whitespace or the end of the buffer
+  if (s < end && !isBlank (*s) && *s != '\n')
+    return (false);
+
+  // Exact mantissa and power of ten give a correctly rounded double; the
+  // narrowing to float is only ambiguous if the double sits on a tie
+  if (exact && mantissa < (static_cast<uint64_t> (1) << 53) && exponent >= -22 && exponent <= 22)
+  {
+    double d = static_cast<double> (mantissa);
+    d = exponent < 0 ? d / pow10[-exponent] : d * pow10[exponent];
+    float f = static_cast<float> (d);
+    uint64_t bits;
+    std::memcpy (&bits, &d, sizeof (bits));
+    bool tie = (bits & 0x1fffffffULL) == 0x10000000ULL;
+    if ((d == 0.0 || (d >= FLT_MIN && d <= FLT_MAX)) && !tie)
+    {
+      value = negative ? -f : f;
+      p = s;
+      return (true);
+    }
+  }
+  if (!parseFloatSlow (p, s, value))
+    return (false);
+  p = s;
+  return (true);
+}
+
+
+// ----------------------------------------------------
+// -----Parse the columns of one line, by point type-----
+// ----------------------------------------------------
+// X Y Z come first. PointXYZI takes the fourth column as intensity and
+// PointXYZRGB columns four to six as 0-255 colour components, which are packed
+// into rgb right here so colour costs no second pass. Further columns are
+// left for the caller to skip.
+inline bool
+parseColumns (const char*& p, const char* end, float* values, int count)
+{
+  for (int i = 0; i < count; ++i)
+  {
+    while (i > 0 && p < end && isBlank (*p))
+      ++p;
+    if (!parseFloat (p, end, values[i]))
+      return (false);
+  }
+  return (true);
+}
+
+inline uint8_t
+toColourComponent (float value)
+{
+  if (!(value > 0.0f))
+    return (0);
+  return (value >= 255.0f ? 255 : static_cast<uint8_t> (value + 0.5f));
+}
+
+inline bool
+parsePoint (const char*& p, const char* end, pcl::PointXYZ& point)
+{
+  return (parseColumns (p, end, point.data, 3));
+}
+
+inline bool
+parsePoint (const char*& p, const char* end, pcl::PointXYZI& point)
+{
+  float values[4];
+  if (!parseColumns (p, end, values, 4))
+    return (false);
+  point.x = values[0];
+  point.y = values[1];
+  point.z = values[2];
+  point.intensity = values[3];
+  return (true);
+}
+
+inline bool
+parsePoint (const char*& p, const char* end, pcl::PointXYZRGB& point)
+{
+  float values[6];
+  if (!parseColumns (p, end, values, 6))
+    return (false);
+  point.x = values[0];
+  point.y = values[1];
+  point.z = values[2];
+  point.r = toColourComponent (values[3]);
+  point.g = toColourComponent (values[4]);
+  point.b = toColourComponent (values[5]);
+  point.a = 255;
+  return (true);
+}
+
+
+// -------------------------------------------------
+// -----Parse the lines of [begin, end) into out-----
+// -------------------------------------------------
+// Writes at most one point per line and returns the number written. Blank
+// lines are skipped; parsing stops at the first malformed line, whose offset
+// is stored in bad_line (NULL if the whole range was parsed).
+//
+// This is line based, unlike the old "in >> x >> y >> z" loop, which read
+// a stream of tokens: a point whose values run onto the next line is a
+// malformed line here, and columns past those of the point type are
+// skipped rather than read as the start of the next point.
+template <typename PointT> size_t
+parseXYZLines (const char* begin, const char* end, PointT* out, const char*& bad_line)
+{
+  size_t n = 0;
+  bad_line = NULL;
+  const char* p = begin;
+  while (p < end)
+  {
+    while (p < end && isBlank (*p))
+      ++p;
+    if (p == end)
+      break;
+    if (*p == '\n')
+    {
+      ++p;
+      continue;
+    }
+
+    const char* line = p;
+    if (!parsePoint (p, end, out[n]))
+    {
+      bad_line = line;
+      break;
+    }
+    ++n;
+
+    // Anything after the columns of the point type is ignored
+    const char* eol = static_cast<const char*> (std::memchr (p, '\n', end - p));
+    p = eol ? eol + 1 : end;
+  }
+  return (n);
+}
+
+
+// Number of columns on the first non-blank line of [begin, end)
+inline int
+countColumns (const char* begin, const char* end)
+{
+  const char* p = begin;
+  while (p < end && (isBlank (*p) || *p == '\n'))
+    ++p;
+  int columns = 0;
+  while (p < end && *p != '\n')
+  {
+    ++columns;
+    while (p < end && !isBlank (*p) && *p != '\n')
+      ++p;
+    while (p < end && isBlank (*p))
+      ++p;
+  }
+  return (columns);
+}
+
+
+inline size_t
+countLines (const char* begin, const char* end)
+{
+  size_t n = 0;
+  const char* p = begin;
+  while (p < end)
+  {
+    const char* eol = static_cast<const char*> (std::memchr (p, '\n', end - p));
+    ++n;
+    p = eol ? eol + 1 : end;
+  }
+  return (n);
+}
+
+
+// -----------------------------------------------------------
+// -----Split a text buffer into chunks at line boundaries-----
+// -----------------------------------------------------------
+inline std::vector<const char*>
+splitAtLines (const char* begin, const char* end, size_t chunks)
+{
+  std::vector<const char*> bounds (1, begin);
+  size_t size = end - begin;
+  for (size_t i = 1; i < chunks; ++i)
+  {
+    const char* p = begin + size * i / chunks;
+    if (p <= bounds.back ())
+      continue;
+    const char* eol = static_cast<const char*> (std::memchr (p, '\n', end - p));
+    if (!eol)
+      break;
+    if (eol + 1 > bounds.back () && eol + 1 < end)
+      bounds.push_back (eol + 1);
+  }
+  bounds.push_back (end);
+  return (bounds);
+}
+
+
+// --------------------------------------------------------
+// -----Parse a text buffer into a cloud on all threads-----
+// --------------------------------------------------------
+// Appends the points of [begin, end) to cloud and returns the number of
+// bytes that were consumed, which is less than the buffer size if a
+// malformed line stopped the parse.
+template <typename PointT> size_t
+parseXYZBuffer (const char* begin, const char* end, pcl::PointCloud<PointT>& cloud)
+{
+  const size_t min_chunk = 1 << 20;
+  size_t size = end - begin;
+  size_t chunks = std::min (static_cast<size_t> (getNumberOfThreads ()) * 4, size / min_chunk + 1);
+  std::vector<const char*> bounds = splitAtLines (begin, end, chunks);
+  int num_chunks = static_cast<int> (bounds.size ()) - 1;
+
+  // Count lines first so every chunk can write straight into its own slice
+  std::vector<size_t> offsets (num_chunks + 1, 0);
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int i = 0; i < num_chunks; ++i)
+    offsets[i + 1] = countLines (bounds[i], bounds[i + 1]);
+  for (int i = 0; i < num_chunks; ++i)
+    offsets[i + 1] += offsets[i];
+
+  size_t first = cloud.points.size ();
+  cloud.points.resize (first + offsets[num_chunks]);
+
+  std::vector<size_t> parsed (num_chunks, 0);
+  std::vector<const char*> bad (num_chunks, static_cast<const char*> (NULL));
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int i = 0; i < num_chunks; ++i)
+    parsed[i] = parseXYZLines (bounds[i], bounds[i + 1], &cloud.points[first + offsets[i]], bad[i]);
+
+  // Close the gaps left by blank lines and drop everything after the first
+  // malformed line, as the stream extraction loop did
+  size_t n = first;
+  size_t consumed = size;
+  for (int i = 0; i < num_chunks; ++i)
+  {
+    if (n != first + offsets[i] && parsed[i] > 0)
+      std::memmove (&cloud.points[n], &cloud.points[first + offsets[i]], parsed[i] * sizeof (PointT));
+    n += parsed[i];
+    if (bad[i])
+    {
+      consumed = bad[i] - begin;
+      break;
+    }
+  }
+  cloud.points.resize (n);
+  cloud.width = static_cast<uint32_t> (n);
+  cloud.height = 1;
+  cloud.is_dense = true;
+  return (consumed);
+}
+
+
+// ------------------------------------------------------------------
+// -----Parse a compressed text file while it is being decompressed-----
+// ------------------------------------------------------------------
+// Chunks come from the Decompressor thread through its bounded queue, so
+// inflating the next chunk overlaps with parsing this one on the remaining
+// cores. A line cut at the end of a chunk is carried over to the next one.
+// Points are appended to cloud, which is emptied before every chunk if
+// per_chunk is set, and on_chunk (if any) is called after each chunk.
+// A malformed line ends the parse with the points before it; complete (if
+// given) tells whether the whole file was parsed.
+template <typename PointT> bool
+parseCompressedXYZFile (const std::string& filename, pcl::PointCloud<PointT>& cloud,
+                        const boost::function<void ()>& on_chunk, bool per_chunk, bool* complete = NULL)
+{
+  if (complete)
+    *complete = false;
+  Decompressor decompressor;
+  if (!decompressor.start (filename))
+    return (false);
+
+  std::vector<char> pending;
+  Decompressor::Chunk chunk;
+  bool more = true;
+  while (more)
+  {
+    more = decompressor.next (chunk);
+    if (more)
+      pending.insert (pending.end (), chunk->begin (), chunk->end ());
+    if (pending.empty ())
+      continue;
+
+    // Parse up to the last complete line, or everything at the end
+    size_t cut = pending.size ();
+    if (more)
+    {
+      while (cut > 0 && pending[cut - 1] != '\n')
+        --cut;
+      if (cut == 0)
+        continue;
+    }
+    if (per_chunk)
+      cloud.points.clear ();
+    size_t consumed = parseXYZBuffer (&pending[0], &pending[0] + cut, cloud);
+    if (on_chunk)
+      on_chunk ();
+    if (consumed < cut)
+    {
+      std::cerr << "Stopped at malformed line in " << filename << std::endl;
+      return (true);
+    }
+    pending.erase (pending.begin (), pending.begin () + cut);
+  }
+  if (complete)
+    *complete = !decompressor.failed ();
+  return (!decompressor.failed ());
+}
+
+
+// --------------------------------------------------------------
+// -----Columns on the first line of a file (0 if unreadable)-----
+// --------------------------------------------------------------
+inline int
+detectColumns (const std::string& filename)
+{
+  if (detectCompression (filename) != COMPRESSION_NONE)
+  {
+    Decompressor decompressor (1 << 16, 1);
+    Decompressor::Chunk chunk;
+    if (!decompressor.start (filename) || !decompressor.next (chunk) || chunk->empty ())
+      return (0);
+    return (countColumns (&(*chunk)[0], &(*chunk)[0] + chunk->size ()));
+  }
+
+  boost::system::error_code ec;
+  uintmax_t size = boost::filesystem::file_size (filename, ec);
+  if (ec || size == 0)
+    return (0);
+  try
+  {
+    boost::iostreams::mapped_file_source file (filename, std::min<uintmax_t> (size, 1 << 16));
+    return (countColumns (file.data (), file.data () + file.size ()));
+  }
+  catch (const std::exception&)
+  {
+    return (0);
+  }
+}
+
+
+// ---------------------------------------------
+// -----Load a text file into a point cloud-----
+// ---------------------------------------------
+template <typename PointT> bool
+loadXYZFile (const std::string& filename, pcl::PointCloud<PointT>& cloud)
+{
+  pcl::console::TicToc tt;
+  tt.tic ();
+
+  if (detectCompression (filename) != COMPRESSION_NONE)
+  {
+    cloud.points.clear ();
+    if (!parseCompressedXYZFile (filename, cloud, boost::function<void ()> (), false))
+      return (false);
+    std::cerr << "Decompressed and parsed " << cloud.points.size () << " points in " << tt.toc () << " ms on "
+              << getNumberOfThreads () << " threads\n";
+    return (true);
+  }
+
+  boost::system::error_code ec;
+  uintmax_t size = boost::filesystem::file_size (filename, ec);
+  if (ec)
+  {
+    std::cerr << "Could not open " << filename << ": " << ec.message () << std::endl;
+    return (false);
+  }
+  cloud.points.clear ();
+  if (size == 0)
+  {
+    cloud.width = cloud.height = 0;
+    return (true);
+  }
+
+  boost::iostreams::mapped_file_source file;
+  try
+  {
+    file.open (filename);
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << "Could not map " << filename << ": " << e.what () << std::endl;
+    return (false);
+  }
+
+  const char* begin = file.data ();
+  const char* end = begin + file.size ();
+  size_t consumed = parseXYZBuffer (begin, end, cloud);
+  if (consumed < file.size ())
+    std::cerr << "Stopped at malformed line at byte " << consumed << " of " << filename << std::endl;
+
+  double ms = tt.toc ();
+  std::cerr << "Parsed " << cloud.points.size () << " points (" << file.size () / (1024.0 * 1024.0)
+            << " MB) in " << ms << " ms: " << file.size () / (1024.0 * 1024.0) / (ms * 0.001 + 1e-9)
+            << " MB/s on " << getNumberOfThreads () << " threads\n";
+  return (true);
+}
+
+
+// -------------------------------------------------------------
+// -----Parse a text file block by block with bounded memory-----
+// -------------------------------------------------------------
+// Calls callback with the points of every block of about block_size bytes;
+// the block cloud is reused, so only one block is in memory at a time.
+// Returns false if the file cannot be read or a malformed line stops it.
+inline bool
+forEachXYZBlock (const std::string& filename, size_t block_size,
+                 const boost::function<void (const pcl::PointCloud<pcl::PointXYZ>&)>& callback)
+{
+  // Compressed input comes in decompressor-sized chunks instead
+  if (detectCompression (filename) != COMPRESSION_NONE)
+  {
+    pcl::PointCloud<pcl::PointXYZ> block;
+    bool complete;
+    return (parseCompressedXYZFile (filename, block, boost::bind (callback, boost::cref (block)), true, &complete) &&
+            complete);
+  }
+
+  boost::iostreams::mapped_file_source file;
+  try
+  {
+    file.open (filename);
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << "Could not map " << filename << ": " << e.what () << std::endl;
+    return (false);
+  }
+
+  pcl::PointCloud<pcl::PointXYZ> block;
+  const char* p = file.data ();
+  const char* end = p + file.size ();
+  while (p < end)
+  {
+    const char* stop = end;
+    if (static_cast<size_t> (end - p) > block_size)
+    {
+      const char* eol = static_cast<const char*> (std::memchr (p + block_size, '\n', end - p - block_size));
+      stop = eol ? eol + 1 : end;
+    }
+    block.points.clear ();
+    size_t consumed = parseXYZBuffer (p, stop, block);
+    callback (block);
+    if (p + consumed < stop)
+    {
+      std::cerr << "Stopped at malformed line at byte " << (p + consumed - file.data ()) << " of " << filename
+                << std::endl;
+      return (false);
+    }
+    p = stop;
+  }
+  return (true);
+}
+
+#endif  // PCL_VISUALIZER_XYZ_LOADER_H_